@@ -0,0 +1,158 @@
+﻿// Copyright © 2025 Land Chaunax, All rights reserved.
+
+
+#include "SmbFlowField.h"
+#include "SmbNavProjection.h"
+
+namespace
+{
+	/* Neighbour offsets, the first four are the straight ones */
+	constexpr int32 NeighborX[8] = { 1, -1, 0, 0, 1, 1, -1, -1 };
+	constexpr int32 NeighborY[8] = { 0, 0, 1, -1, 1, -1, 1, -1 };
+
+	struct FOpenCell
+	{
+		float Cost = 0.f;
+		int32 CellIndex = INDEX_NONE;
+	};
+
+	struct FCheaperFirst
+	{
+		bool operator()(const FOpenCell& A, const FOpenCell& B) const
+		{
+			return A.Cost < B.Cost;
+		}
+	};
+}
+
+FSmbFlowField::FSmbFlowField(const FVector& InGoal, float InGoalRadius, const FBox2D& InBounds, float InCellSize)
+	: Goal(InGoal)
+	, GoalRadius(InGoalRadius)
+	, Origin(InBounds.Min)
+	, CellSize(FMath::Max(InCellSize, 1.f))
+{
+	SizeX = FMath::Max(1, FMath::CeilToInt32((InBounds.Max.X-InBounds.Min.X)/CellSize));
+	SizeY = FMath::Max(1, FMath::CeilToInt32((InBounds.Max.Y-InBounds.Min.Y)/CellSize));
+	Walkable.Init(false, SizeX*SizeY);
+}
+
+int32 FSmbFlowField::CellIndexOf(const FVector2D& Location) const
+{
+	const int32 X = FMath::FloorToInt32((Location.X-Origin.X)/CellSize);
+	const int32 Y = FMath::FloorToInt32((Location.Y-Origin.Y)/CellSize);
+	if (X < 0 || Y < 0 || X >= SizeX || Y >= SizeY) return INDEX_NONE;
+	return Y*SizeX+X;
+}
+
+int32 FSmbFlowField::SampleWalkable(UWorld& World, float VerticalExtent, int32 MaxSamples)
+{
+	const int32 NumCells = SizeX*SizeY;
+	const int32 FirstCell = NextSampleCell;
+	const int32 EndCell = FMath::Min(NumCells, FirstCell+FMath::Max(MaxSamples, 0));
+	if (EndCell <= FirstCell) return 0;
+
+	TArray<FSmbNavProjection> Projections;
+	Projections.SetNum(EndCell-FirstCell);
+	for (int32 CellIndex = FirstCell; CellIndex < EndCell; ++CellIndex)
+	{
+		FSmbNavProjection& Projection = Projections[CellIndex-FirstCell];
+		Projection.Point = FVector(Origin.X+(CellIndex%SizeX+0.5)*CellSize, Origin.Y+(CellIndex/SizeX+0.5)*CellSize, Goal.Z);
+		Projection.Extent = FVector(CellSize*0.5f, CellSize*0.5f, VerticalExtent);
+	}
+	FSmbNavProjectionService::ProjectAll(World, Projections);
+	for (int32 CellIndex = FirstCell; CellIndex < EndCell; ++CellIndex)
+	{
+		Walkable[CellIndex] = Projections[CellIndex-FirstCell].bFound;
+	}
+	NextSampleCell = EndCell;
+	return EndCell-FirstCell;
+}
+
+void FSmbFlowField::Build()
+{
+	check(IsSampled());
+	const int32 NumCells = SizeX*SizeY;
+
+	TArray<float> Cost;
+	Cost.Init(MAX_flt, NumCells);
+	TArray<FOpenCell> Open;
+	const double GoalReachSquared = FMath::Square(GoalRadius+CellSize*0.5f);
+	for (int32 CellIndex = 0; CellIndex < NumCells; ++CellIndex)
+	{
+		if (!Walkable[CellIndex]) continue;
+		// Every walkable cell of the destination area is a goal, units spread over it instead of queueing for one cell
+		const FVector2D Center(Origin.X+(CellIndex%SizeX+0.5)*CellSize, Origin.Y+(CellIndex/SizeX+0.5)*CellSize);
+		if (FVector2D::DistSquared(Center, FVector2D(Goal)) > GoalReachSquared) continue;
+		Cost[CellIndex] = 0.f;
+		Open.HeapPush(FOpenCell{0.f, CellIndex}, FCheaperFirst());
+	}
+
+	// Diagonal steps may not cut a blocked corner, both straight cells next to them have to be walkable
+	auto CanStep = [this, &Walkable](int32 X, int32 Y, int32 Neighbor)
+	{
+		const int32 NextX = X+NeighborX[Neighbor];
+		const int32 NextY = Y+NeighborY[Neighbor];
+		if (NextX < 0 || NextY < 0 || NextX >= SizeX || NextY >= SizeY) return false;
+		if (!Walkable[NextY*SizeX+NextX]) return false;
+		if (Neighbor < 4) return true;
+		return Walkable[Y*SizeX+NextX] && Walkable[NextY*SizeX+X];
+	};
+
+	while (Open.Num() > 0)
+	{
+		if (bCancelled.load(std::memory_order_relaxed)) return;
+		FOpenCell Current;
+		Open.HeapPop(Current, FCheaperFirst(), EAllowShrinking::No);
+		if (Current.Cost > Cost[Current.CellIndex]) continue;
+		const int32 X = Current.CellIndex%SizeX;
+		const int32 Y = Current.CellIndex/SizeX;
+		for (int32 Neighbor = 0; Neighbor < 8; ++Neighbor)
+		{
+			if (!CanStep(X, Y, Neighbor)) continue;
+			const int32 NextIndex = (Y+NeighborY[Neighbor])*SizeX+X+NeighborX[Neighbor];
+			const float NextCost = Current.Cost+(Neighbor < 4 ? 1.f : UE_SQRT_2);
+			if (NextCost >= Cost[NextIndex]) continue;
+			Cost[NextIndex] = NextCost;
+			Open.HeapPush(FOpenCell{NextCost, NextIndex}, FCheaperFirst());
+		}
+	}
+
+	Directions.Init(NoDirection, NumCells);
+	for (int32 CellIndex = 0; CellIndex < NumCells; ++CellIndex)
+	{
+		if (Cost[CellIndex] <= 0.f || Cost[CellIndex] == MAX_flt) continue;
+		const int32 X = CellIndex%SizeX;
+		const int32 Y = CellIndex/SizeX;
+		float BestCost = Cost[CellIndex];
+		for (int32 Neighbor = 0; Neighbor < 8; ++Neighbor)
+		{
+			if (!CanStep(X, Y, Neighbor)) continue;
+			const float NeighborCost = Cost[(Y+NeighborY[Neighbor])*SizeX+X+NeighborX[Neighbor]];
+			if (NeighborCost >= BestCost) continue;
+			BestCost = NeighborCost;
+			Directions[CellIndex] = static_cast<uint8>(Neighbor);
+		}
+	}
+	Walkable.Empty();
+	bReady.store(true, std::memory_order_release);
+}
+
+bool FSmbFlowField::SampleDirection(const FVector& Location, FVector2D& OutDirection) const
+{
+	if (!IsReady()) return false;
+	const int32 CellIndex = CellIndexOf(FVector2D(Location));
+	if (CellIndex == INDEX_NONE) return false;
+	const uint8 Neighbor = Directions[CellIndex];
+	if (Neighbor == NoDirection) return false;
+	OutDirection = FVector2D(NeighborX[Neighbor], NeighborY[Neighbor]).GetSafeNormal();
+	return true;
+}
+
+bool FSmbFlowField::CanServe(const FVector& InGoal, float InGoalRadius, const FBox2D& InBounds) const
+{
+	if (FVector2D::DistSquared(FVector2D(InGoal), FVector2D(Goal)) > FMath::Square(CellSize)) return false;
+	if (FMath::Abs(InGoalRadius-GoalRadius) > CellSize) return false;
+	if (!InBounds.bIsValid) return true;
+	const FVector2D Max = Origin+FVector2D(SizeX, SizeY)*CellSize;
+	return InBounds.Min.X >= Origin.X && InBounds.Min.Y >= Origin.Y && InBounds.Max.X <= Max.X && InBounds.Max.Y <= Max.Y;
+}
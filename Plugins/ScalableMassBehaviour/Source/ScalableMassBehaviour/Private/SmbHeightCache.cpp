@@ -0,0 +1,148 @@
+﻿// Copyright © 2025 Land Chaunax, All rights reserved.
+
+
+#include "SmbHeightCache.h"
+#include "SmbNavProjection.h"
+#include "Misc/ScopeLock.h"
+
+
+FIntPoint FSmbHeightCache::ToSample(const FVector& Location) const
+{
+	return FIntPoint(FMath::RoundToInt32(Location.X/Spacing), FMath::RoundToInt32(Location.Y/Spacing));
+}
+
+FSmbHeightCache::EState FSmbHeightCache::GetState(const FIntPoint& SampleCoord, float& OutHeight) const
+{
+	const int32* TileIndex = TileLookup.Find(FIntPoint(FloorDiv(SampleCoord.X, TileSamples), FloorDiv(SampleCoord.Y, TileSamples)));
+	if (!TileIndex) return EState::Unknown;
+	const int32 LocalX = SampleCoord.X-FloorDiv(SampleCoord.X, TileSamples)*TileSamples;
+	const int32 LocalY = SampleCoord.Y-FloorDiv(SampleCoord.Y, TileSamples)*TileSamples;
+	const int32 Slot = LocalY*TileSamples+LocalX;
+	const FTile& Tile = Tiles[*TileIndex];
+	OutHeight = Tile.Heights[Slot];
+	return Tile.States[Slot];
+}
+
+ESmbHeightSample FSmbHeightCache::Sample(const FVector& Location, float MaxHeightDifference, float& OutHeight) const
+{
+	const double SampleX = Location.X/Spacing;
+	const double SampleY = Location.Y/Spacing;
+	const int32 X0 = FMath::FloorToInt32(SampleX);
+	const int32 Y0 = FMath::FloorToInt32(SampleY);
+	float Corners[4];
+	bool bMissing = false;
+	for (int32 Corner = 0; Corner < 4; ++Corner)
+	{
+		const EState State = GetState(FIntPoint(X0+(Corner&1), Y0+(Corner>>1)), Corners[Corner]);
+		if (State == EState::NoNav) return ESmbHeightSample::NoNav;
+		bMissing |= State == EState::Unknown;
+	}
+	if (bMissing) return ESmbHeightSample::Miss;
+
+	const float AlphaX = static_cast<float>(SampleX-X0);
+	const float AlphaY = static_cast<float>(SampleY-Y0);
+	const float Height = FMath::Lerp(FMath::Lerp(Corners[0], Corners[1], AlphaX), FMath::Lerp(Corners[2], Corners[3], AlphaX), AlphaY);
+	if (FMath::Abs(Height-Location.Z) > MaxHeightDifference) return ESmbHeightSample::NoNav;
+	OutHeight = Height;
+	return ESmbHeightSample::Hit;
+}
+
+void FSmbHeightCache::RequestMissing(const FVector& Location, TArray<FVector>& OutRequests) const
+{
+	const int32 X0 = FMath::FloorToInt32(Location.X/Spacing);
+	const int32 Y0 = FMath::FloorToInt32(Location.Y/Spacing);
+	for (int32 Corner = 0; Corner < 4; ++Corner)
+	{
+		const FIntPoint SampleCoord = FIntPoint(X0+(Corner&1), Y0+(Corner>>1));
+		float Height;
+		if (GetState(SampleCoord, Height) != EState::Unknown) continue;
+		// The requester's height picks the level the sample is projected from
+		OutRequests.Add(FVector(SampleCoord.X*Spacing, SampleCoord.Y*Spacing, Location.Z));
+	}
+}
+
+void FSmbHeightCache::Submit(TArray<FVector>& Requests)
+{
+	if (Requests.Num() == 0) return;
+	FScopeLock Lock(&PendingLock);
+	Pending.Append(Requests);
+	Requests.Reset();
+}
+
+void FSmbHeightCache::Resolve(UWorld& World, int32 MaxSamples)
+{
+	{
+		FScopeLock Lock(&PendingLock);
+		Swap(Requested, Pending);
+		Pending.Reset();
+	}
+	if (Requested.Num() == 0) return;
+
+	// Neighbouring entities ask for the same samples, each one is projected once
+	TSet<FIntPoint> Seen;
+	TArray<FSmbNavProjection> Projections;
+	for (const FVector& Request : Requested)
+	{
+		if (Projections.Num() >= MaxSamples) break;
+		const FIntPoint SampleCoord = ToSample(Request);
+		bool bAlreadySeen = false;
+		Seen.Add(SampleCoord, &bAlreadySeen);
+		if (bAlreadySeen) continue;
+		float Height;
+		if (GetState(SampleCoord, Height) != EState::Unknown) continue;
+		FSmbNavProjection& Projection = Projections.AddDefaulted_GetRef();
+		Projection.Point = Request;
+		Projection.Extent = FVector(Spacing*0.5f, Spacing*0.5f, 700.f);
+	}
+	Requested.Reset();
+	FSmbNavProjectionService::ProjectAll(World, Projections);
+
+	for (const FSmbNavProjection& Projection : Projections)
+	{
+		const FIntPoint SampleCoord = ToSample(Projection.Point);
+		const FIntPoint TileCoord = FIntPoint(FloorDiv(SampleCoord.X, TileSamples), FloorDiv(SampleCoord.Y, TileSamples));
+		int32 TileIndex = INDEX_NONE;
+		if (const int32* Found = TileLookup.Find(TileCoord))
+		{
+			TileIndex = *Found;
+		}
+		else
+		{
+			TileIndex = Tiles.AddDefaulted();
+			FTile& NewTile = Tiles[TileIndex];
+			for (int32 Slot = 0; Slot < TileSamples*TileSamples; ++Slot)
+			{
+				NewTile.Heights[Slot] = 0.f;
+				NewTile.States[Slot] = EState::Unknown;
+			}
+			TileLookup.Add(TileCoord, TileIndex);
+		}
+		const int32 Slot = (SampleCoord.Y-TileCoord.Y*TileSamples)*TileSamples+SampleCoord.X-TileCoord.X*TileSamples;
+		FTile& Tile = Tiles[TileIndex];
+		Tile.Heights[Slot] = Projection.bFound ? static_cast<float>(Projection.Location.Z) : 0.f;
+		Tile.States[Slot] = Projection.bFound ? EState::Valid : EState::NoNav;
+	}
+}
+
+void FSmbHeightCache::Invalidate()
+{
+	Tiles.Reset();
+	TileLookup.Reset();
+}
+
+void FSmbHeightCache::SetSampleSpacing(float InSpacing)
+{
+	const float NewSpacing = FMath::Max(InSpacing, 1.f);
+	if (NewSpacing == Spacing) return;
+	Spacing = NewSpacing;
+	Invalidate();
+}
+
+void FSmbHeightCache::Reset()
+{
+	FScopeLock Lock(&PendingLock);
+	Pending.Empty();
+	Requested.Empty();
+	Tiles.Empty();
+	TileLookup.Empty();
+}
@@ -0,0 +1,164 @@
+﻿// Copyright © 2025 Land Chaunax, All rights reserved.
+
+
+#include "SmbInfluenceMap.h"
+
+
+bool FSmbInfluenceMap::IsEnemyOf(const FSmbInfluenceTeam& TeamInfluence, int32 InTeam)
+{
+	return TeamInfluence.Num > 0 && TeamInfluence.Team != InTeam && TeamInfluence.Team != FSmbSpatialGrid::NoTeam;
+}
+
+const FSmbInfluenceMap::FEntry* FSmbInfluenceMap::FindEntry(FMassEntityHandle Handle) const
+{
+	if (!Entries.IsValidIndex(Handle.Index)) return nullptr;
+	const FEntry& Entry = Entries[Handle.Index];
+	if (Entry.CellIndex == INDEX_NONE || Entry.SerialNumber != Handle.SerialNumber) return nullptr;
+	return &Entry;
+}
+
+int32 FSmbInfluenceMap::FindCell(int32 X, int32 Y) const
+{
+	const int32* CellIndex = CellLookup.Find(FIntPoint(X, Y));
+	return CellIndex ? *CellIndex : INDEX_NONE;
+}
+
+void FSmbInfluenceMap::AddToCell(int32 CellIndex, int32 Team, int32 Count, float Strength)
+{
+	FCell& Cell = Cells[CellIndex];
+	for (int32 i = 0; i < Cell.Teams.Num(); ++i)
+	{
+		FSmbInfluenceTeam& TeamInfluence = Cell.Teams[i];
+		if (TeamInfluence.Team != Team) continue;
+		TeamInfluence.Num += Count;
+		TeamInfluence.Strength += Strength;
+		if (TeamInfluence.Num <= 0)
+		{
+			//Float sums drift after enough adds and subtracts, the last one out leaves nothing behind
+			Cell.Teams.RemoveAtSwap(i, EAllowShrinking::No);
+		}
+		return;
+	}
+	if (Count <= 0) return;
+	FSmbInfluenceTeam& TeamInfluence = Cell.Teams.AddDefaulted_GetRef();
+	TeamInfluence.Team = Team;
+	TeamInfluence.Num = Count;
+	TeamInfluence.Strength = Strength;
+}
+
+void FSmbInfluenceMap::Set(FMassEntityHandle Handle, const FIntPoint& Cell, int32 Team, float Strength)
+{
+	if (!Handle.IsSet()) return;
+	if (Strength <= 0.f)
+	{
+		Remove(Handle);
+		return;
+	}
+	if (Handle.Index >= Entries.Num()) Entries.AddDefaulted(Handle.Index+1-Entries.Num());
+
+	FEntry& Entry = Entries[Handle.Index];
+	if (Entry.CellIndex != INDEX_NONE)
+	{
+		//Same for a recycled index, whatever the previous owner left is taken back out
+		AddToCell(Entry.CellIndex, Entry.Team, -1, -Entry.Strength);
+	}
+
+	int32 CellIndex = FindCell(Cell.X, Cell.Y);
+	if (CellIndex == INDEX_NONE)
+	{
+		CellIndex = Cells.AddDefaulted();
+		CellLookup.Add(Cell, CellIndex);
+	}
+	AddToCell(CellIndex, Team, 1, Strength);
+	Entry.SerialNumber = Handle.SerialNumber;
+	Entry.CellIndex = CellIndex;
+	Entry.Team = Team;
+	Entry.Strength = Strength;
+}
+
+void FSmbInfluenceMap::SetStrength(FMassEntityHandle Handle, float Strength)
+{
+	if (!FindEntry(Handle)) return;
+	if (Strength <= 0.f)
+	{
+		Remove(Handle);
+		return;
+	}
+	FEntry& Entry = Entries[Handle.Index];
+	AddToCell(Entry.CellIndex, Entry.Team, 0, Strength-Entry.Strength);
+	Entry.Strength = Strength;
+}
+
+void FSmbInfluenceMap::Remove(FMassEntityHandle Handle)
+{
+	if (!FindEntry(Handle)) return;
+	FEntry& Entry = Entries[Handle.Index];
+	AddToCell(Entry.CellIndex, Entry.Team, -1, -Entry.Strength);
+	Entry = FEntry();
+}
+
+bool FSmbInfluenceMap::Contains(FMassEntityHandle Handle) const
+{
+	return FindEntry(Handle) != nullptr;
+}
+
+float FSmbInfluenceMap::GetStrength(FMassEntityHandle Handle) const
+{
+	const FEntry* Entry = FindEntry(Handle);
+	return Entry ? Entry->Strength : 0.f;
+}
+
+TConstArrayView<FSmbInfluenceTeam> FSmbInfluenceMap::GetTeamsAt(int32 X, int32 Y) const
+{
+	const int32 CellIndex = FindCell(X, Y);
+	if (CellIndex == INDEX_NONE) return TConstArrayView<FSmbInfluenceTeam>();
+	return Cells[CellIndex].Teams;
+}
+
+float FSmbInfluenceMap::GetEnemyStrengthAt(int32 X, int32 Y, int32 InTeam) const
+{
+	float Strength = 0.f;
+	for (const FSmbInfluenceTeam& TeamInfluence : GetTeamsAt(X, Y))
+	{
+		if (IsEnemyOf(TeamInfluence, InTeam)) Strength += TeamInfluence.Strength;
+	}
+	return Strength;
+}
+
+bool FSmbInfluenceMap::HasEnemyAround(int32 X, int32 Y, int32 Radius, int32 InTeam) const
+{
+	for (int32 i = -Radius; i <= Radius; ++i)
+	{
+		for (int32 j = -Radius; j <= Radius; ++j)
+		{
+			for (const FSmbInfluenceTeam& TeamInfluence : GetTeamsAt(X+i, Y+j))
+			{
+				if (IsEnemyOf(TeamInfluence, InTeam)) return true;
+			}
+		}
+	}
+	return false;
+}
+
+bool FSmbInfluenceMap::FindStrongestEnemyCell(int32 X, int32 Y, int32 Radius, int32 InTeam, FIntPoint& OutCell, float& OutStrength) const
+{
+	OutStrength = 0.f;
+	for (int32 i = -Radius; i <= Radius; ++i)
+	{
+		for (int32 j = -Radius; j <= Radius; ++j)
+		{
+			const float Strength = GetEnemyStrengthAt(X+i, Y+j, InTeam);
+			if (Strength <= OutStrength) continue;
+			OutStrength = Strength;
+			OutCell = FIntPoint(X+i, Y+j);
+		}
+	}
+	return OutStrength > 0.f;
+}
+
+void FSmbInfluenceMap::EmptySelf()
+{
+	Cells.Empty();
+	CellLookup.Empty();
+	Entries.Empty();
+}
@@ -0,0 +1,73 @@
+﻿// Copyright © 2025 Land Chaunax, All rights reserved.
+
+
+#include "SmbNavProjection.h"
+#include "Async/ParallelFor.h"
+#include "Misc/ScopeLock.h"
+#include "NavigationSystem.h"
+
+
+void FSmbNavProjectionService::Submit(TArray<FSmbNavProjection>& Projections)
+{
+	if (Projections.Num() == 0) return;
+	FScopeLock Lock(&PendingLock);
+	Pending.Append(Projections);
+	Projections.Reset();
+}
+
+void FSmbNavProjectionService::Submit(const FSmbNavProjection& Projection)
+{
+	FScopeLock Lock(&PendingLock);
+	Pending.Add(Projection);
+}
+
+void FSmbNavProjectionService::Resolve(UWorld& World)
+{
+	{
+		// The old results become next frame's queue, both keep their allocations
+		FScopeLock Lock(&PendingLock);
+		Swap(Resolved, Pending);
+		Pending.Reset();
+	}
+	ProjectAll(World, Resolved);
+}
+
+void FSmbNavProjectionService::ProjectAll(UWorld& World, TArrayView<FSmbNavProjection> Projections)
+{
+	if (Projections.Num() == 0) return;
+	UNavigationSystemV1* NavSys = FNavigationSystem::GetCurrent<UNavigationSystemV1>(&World);
+	const ANavigationData* NavData = NavSys ? NavSys->GetDefaultNavDataInstance() : nullptr;
+	if (NavData)
+	{
+		// Tile updates wait until the lock goes out of scope, the workers read a navmesh nobody writes to
+		FNavigationLockContext NavLock(&World, ENavigationLockReason::Unknown);
+		const FSharedConstNavQueryFilter Filter = NavData->GetDefaultQueryFilter();
+		ParallelFor(TEXT("SmbNavProjections"), Projections.Num(), 64, [Projections, NavData, &Filter](int32 Index)
+		{
+			FSmbNavProjection& Projection = Projections[Index];
+			FNavLocation NavLocation;
+			Projection.bFound = NavData->ProjectPoint(Projection.Point, NavLocation, Projection.Extent, Filter);
+			if (!Projection.bFound && !Projection.FallbackExtent.IsZero())
+			{
+				Projection.bFound = NavData->ProjectPoint(Projection.Point, NavLocation, Projection.FallbackExtent, Filter);
+				Projection.bFoundWithFallback = Projection.bFound;
+			}
+			Projection.Location = Projection.bFound ? NavLocation.Location : Projection.FailLocation;
+		});
+	}
+	else
+	{
+		for (FSmbNavProjection& Projection : Projections)
+		{
+			Projection.bFound = false;
+			Projection.Location = Projection.FailLocation;
+		}
+	}
+}
+
+void FSmbNavProjectionService::Reset()
+{
+	FScopeLock Lock(&PendingLock);
+	Pending.Empty();
+	Resolved.Empty();
+}
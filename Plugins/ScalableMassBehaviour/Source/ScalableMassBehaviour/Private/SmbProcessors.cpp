@@ -7,6 +7,7 @@
 #include "MassCommonFragments.h"
 #include "MassCommonTypes.h"
 #include "MassExecutionContext.h"
+#include "MassEntityView.h"
 #include "SmbFragments.h"
 #include "MassRepresentationSubsystem.h"
 #include "MassRepresentationProcessor.h"
@@ -17,11 +18,44 @@
 #include "MassMovementFragments.h"
 #include "MassNavigationFragments.h"
 #include "MassSignalSubsystem.h"
+#include "MassSimulationLOD.h"
+#include "CoreGlobals.h"
+#include "Math/RandomStream.h"
+#include "Misc/ScopeLock.h"
 #include "NavigationSystem.h"
 #include "SmbAnimComp.h"
 #include "GameFramework/Character.h"
 #include "Components/SkeletalMeshComponent.h"
 
+namespace
+{
+	/* Entities with simulation LOD only tick when their chunk is due, the chunk filter skips the rest unless the caller
+	 * has to visit every chunk every frame and checks ShouldTickChunkThisFrame itself */
+	void AddVariableTickRequirements(FMassEntityQuery& Query, const bool bFilterChunks = true)
+	{
+		Query.AddRequirement<FMassSimulationVariableTickFragment>(EMassFragmentAccess::ReadOnly, EMassFragmentPresence::Optional);
+		Query.AddChunkRequirement<FMassSimulationVariableTickChunkFragment>(EMassFragmentAccess::ReadOnly, EMassFragmentPresence::Optional);
+		if (bFilterChunks)
+		{
+			Query.SetChunkFilter(&FMassSimulationVariableTickChunkFragment::ShouldTickChunkThisFrame);
+		}
+	}
+
+	/* Time since the entity last ticked, several frames when its LOD thins it out and the frame time without simulation LOD */
+	float GetEntityDeltaTime(TConstArrayView<FMassSimulationVariableTickFragment> VariableTickView, int32 EntityIndex, float FrameDeltaTime)
+	{
+		return VariableTickView.Num() > 0 ? VariableTickView[EntityIndex].DeltaTime : FrameDeltaTime;
+	}
+
+	/* Random numbers for one pass over a chunk, seeded from its first entity and the frame. FMath::RandRange shares the global rand()
+	 * state, which parallel chunks would race on and which makes the result depend on how the workers happened to be scheduled */
+	FRandomStream MakeChunkRandomStream(const FMassExecutionContext& Context)
+	{
+		const uint32 FirstEntityHash = Context.GetNumEntities() > 0 ? GetTypeHash(Context.GetEntity(0)) : 0;
+		return FRandomStream(static_cast<int32>(HashCombineFast(FirstEntityHash, static_cast<uint32>(GFrameCounter))));
+	}
+}
+
 UAnimationProcessor::UAnimationProcessor()
 	:EntityQuery(*this)
 {
@@ -34,10 +68,13 @@ void UAnimationProcessor::ConfigureQueries(const TSharedRef<FMassEntityManager>&
 {
 	EntityQuery.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadOnly);
 	EntityQuery.AddRequirement<FAnimationFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddConstSharedRequirement<FAnimationParams>();
 	EntityQuery.AddSharedRequirement<FVertexAnimations>(EMassFragmentAccess::ReadOnly);
 	EntityQuery.AddRequirement<FMassRepresentationLODFragment>(EMassFragmentAccess::ReadOnly);
 	EntityQuery.AddRequirement<FMassRepresentationFragment>(EMassFragmentAccess::ReadOnly);
 	EntityQuery.AddRequirement<FMassActorFragment>(EMassFragmentAccess::ReadWrite);
+	// The instanced meshes take custom data for every instance every frame, a skipped chunk would shift everyone after it
+	AddVariableTickRequirements(EntityQuery, false);
 
 	EntityQuery.RegisterWithProcessor(*this);
 }
@@ -64,13 +101,19 @@ void UAnimationProcessor::Execute(FMassEntityManager& EntityManager, FMassExecut
 		FMassInstancedStaticMeshInfoArrayView ISMInfosView = RepresentationSubsystem->GetMutableInstancedStaticMeshInfos();
 		TArrayView<FAnimationFragment> AnimationFragmentArrayView = Context.GetMutableFragmentView<FAnimationFragment>();
 		FVertexAnimations VertFrag = Context.GetSharedFragment<FVertexAnimations>();
+		const FAnimationParams& AnimationParams = Context.GetConstSharedFragment<FAnimationParams>();
 		TConstArrayView<FMassActorFragment> ActorFragmentArrayView = Context.GetMutableFragmentView<FMassActorFragment>();
 		const TConstArrayView<FTransformFragment> TransformFragmentArrayView = Context.GetFragmentView<FTransformFragment>();
+		const TConstArrayView<FMassSimulationVariableTickFragment> VariableTickView = Context.GetFragmentView<FMassSimulationVariableTickFragment>();
+		// Chunks that are not due still write their frames, they just don't advance until their LOD lets them
+		const bool bChunkTicks = FMassSimulationVariableTickChunkFragment::ShouldTickChunkThisFrame(Context);
+		FRandomStream RandomStream = MakeChunkRandomStream(Context);
 
 		for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
 		{
 			FAnimationFragment& AnimationFragment = AnimationFragmentArrayView[EntityIndex];
 			FMassRepresentationFragment RepresentationFragment = RepresentationFragmentArrayView[EntityIndex];
+			const float EntityDeltaTime = bChunkTicks ? GetEntityDeltaTime(VariableTickView, EntityIndex, DeltaTime) : 0.f;
 			if (!ISMInfosView.IsValidIndex(RepresentationFragment.StaticMeshDescHandle.ToIndex())) continue;
 			FMassInstancedStaticMeshInfo ISMInfo = ISMInfosView[RepresentationFragment.StaticMeshDescHandle.ToIndex()];
 			
@@ -87,7 +130,7 @@ void UAnimationProcessor::Execute(FMassEntityManager& EntityManager, FMassExecut
 
 			if (AnimationFragment.LerpAlpha > 0)
 			{
-				AnimationFragment.LerpAlpha = FMath::Clamp(AnimationFragment.LerpAlpha-DeltaTime*AnimationFragment.BlendSpeed,0.f,1.f);
+				AnimationFragment.LerpAlpha = FMath::Clamp(AnimationFragment.LerpAlpha-EntityDeltaTime*AnimationParams.BlendSpeed,0.f,1.f);
 			}
 			for (int i = 0; i < Ordering.Num(); ++i)
 			{
@@ -103,7 +146,7 @@ void UAnimationProcessor::Execute(FMassEntityManager& EntityManager, FMassExecut
 				}
 				CumulativeFrames += CurrentMaxFrame;
 			}
-			AnimationFragment.CurrentAnimationFrame += AnimationFragment.AnimationSpeed*DeltaTime*Framerate;
+			AnimationFragment.CurrentAnimationFrame += AnimationParams.AnimationSpeed*EntityDeltaTime*Framerate;
 
 			//New Animation (Note switching requires blending to be finished)
 			if (AnimationFragment.CurrentState != AnimationFragment.PreviousState && AnimationFragment.LerpAlpha <= 0.f)
@@ -113,7 +156,7 @@ void UAnimationProcessor::Execute(FMassEntityManager& EntityManager, FMassExecut
 				AnimationFragment.CurrentAnimationFrame = 0;
 				if (AnimationFragment.CurrentState == EAnimationState::Running)
 				{
-					AnimationFragment.CurrentAnimationFrame = FMath::RandRange(StartFrame,EndFrame);
+					AnimationFragment.CurrentAnimationFrame = RandomStream.FRandRange(StartFrame,EndFrame);
 				}
 				AnimationFragment.PreviousState = AnimationFragment.CurrentState;
 				AnimationFragment.TimeInCurrentAnimation = 0;
@@ -173,10 +216,10 @@ void UAnimationProcessor::Execute(FMassEntityManager& EntityManager, FMassExecut
 				ISMInfo.AddBatchedCustomDataFloats({CurrentFrame,
 					PreviousFrame,
 					AnimationFragment.LerpAlpha,
-					AnimationFragment.AnimationUnitScale},
+					AnimationParams.AnimationUnitScale},
 					RepresentationLOD.LODSignificance, RepresentationLOD.PrevLOD);
 			}
-			AnimationFragment.TimeInCurrentAnimation += DeltaTime;
+			AnimationFragment.TimeInCurrentAnimation += EntityDeltaTime;
 		}
 	});
 }
@@ -187,7 +230,6 @@ URegisterProcessor::URegisterProcessor()
 	bAutoRegisterWithProcessingPhases = true;
 	ExecutionFlags = (int32)(EProcessorExecutionFlags::AllNetModes);
 	ExecutionOrder.ExecuteBefore.Add(UE::Mass::ProcessorGroupNames::Movement);
-	bRequiresGameThreadExecution = true;
 	//ExecutionOrder.ExecuteInGroup = UE::Mass::ProcessorGroupNames::Movement;
 }
 
@@ -197,27 +239,41 @@ void URegisterProcessor::ConfigureQueries(const TSharedRef<FMassEntityManager>&
 
 	EntityQuery.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadWrite);
 	EntityQuery.AddRequirement<FLocationDataFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddRequirement<FLocationTargetFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddConstSharedRequirement<FLocationDataParams>();
 	EntityQuery.AddRequirement<FMassMoveTargetFragment>(EMassFragmentAccess::ReadWrite);
 	EntityQuery.AddRequirement<FAnimationFragment>(EMassFragmentAccess::ReadWrite);
+	// Copied into the grid so queries don't have to look them up per candidate
+	EntityQuery.AddRequirement<FAgentRadiusFragment>(EMassFragmentAccess::ReadOnly, EMassFragmentPresence::Optional);
+	EntityQuery.AddRequirement<FTeamFragment>(EMassFragmentAccess::ReadOnly, EMassFragmentPresence::Optional);
+	EntityQuery.AddRequirement<FDefenceFragment>(EMassFragmentAccess::ReadOnly, EMassFragmentPresence::Optional);
+	EntityQuery.AddRequirement<FCollisionDataFragment>(EMassFragmentAccess::ReadOnly, EMassFragmentPresence::Optional);
+	EntityQuery.AddTagRequirement<FSmbSleepingTag>(EMassFragmentPresence::None);
+	AddVariableTickRequirements(EntityQuery);
 	EntityQuery.AddSubsystemRequirement<USmbSubsystem>(EMassFragmentAccess::ReadWrite);
-	EntityQuery.AddSubsystemRequirement<UMassSignalSubsystem>(EMassFragmentAccess::ReadWrite);
 }
 
 void URegisterProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
 {
 	float DeltaTime = FMath::Min(Context.GetDeltaTimeSeconds(),0.2f);
 
-	EntityQuery.ForEachEntityChunk(Context, [this, DeltaTime](FMassExecutionContext& Context)
+	// Chunks only write their own slots in the grid, cell changes are collected and applied after the parallel pass
+	EntityQuery.ParallelForEachEntityChunk(Context, [this, DeltaTime](FMassExecutionContext& Context)
 	{
 		USmbSubsystem& SmbSubsystem = Context.GetMutableSubsystemChecked<USmbSubsystem>();
 		TArrayView<FTransformFragment> TransformFragmentArrayView = Context.GetMutableFragmentView<FTransformFragment>();
 		TArrayView<FLocationDataFragment> LocationDataFragmentArrayView = Context.GetMutableFragmentView<FLocationDataFragment>();
-		TArrayView<FMassMoveTargetFragment> MoveTargetFragmentArrayView = Context.GetMutableFragmentView<FMassMoveTargetFragment>();
-		UMassSignalSubsystem& SignalSubsystem = Context.GetMutableSubsystemChecked<UMassSignalSubsystem>();
+		TArrayView<FLocationTargetFragment> LocationTargetFragmentArrayView = Context.GetMutableFragmentView<FLocationTargetFragment>();
+		const FLocationDataParams& LocationParams = Context.GetConstSharedFragment<FLocationDataParams>();
 		TArrayView<FAnimationFragment> AnimationFragmentArrayView = Context.GetMutableFragmentView<FAnimationFragment>();
-
-		
-		TArray<FMassEntityHandle> EntitiesToSignal = TArray<FMassEntityHandle>();
+		TConstArrayView<FAgentRadiusFragment> AgentRadiusArrayView = Context.GetFragmentView<FAgentRadiusFragment>();
+		TConstArrayView<FTeamFragment> TeamArrayView = Context.GetFragmentView<FTeamFragment>();
+		TConstArrayView<FDefenceFragment> DefenceArrayView = Context.GetFragmentView<FDefenceFragment>();
+		TConstArrayView<FCollisionDataFragment> CollisionArrayView = Context.GetFragmentView<FCollisionDataFragment>();
+		TConstArrayView<FMassSimulationVariableTickFragment> VariableTickView = Context.GetFragmentView<FMassSimulationVariableTickFragment>();
+
+		TArray<FSmbGridMove> GridMoves;
+		FRandomStream RandomStream = MakeChunkRandomStream(Context);
 		
 		for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
 		{
@@ -227,45 +283,22 @@ void URegisterProcessor::Execute(FMassEntityManager& EntityManager, FMassExecuti
 
 			//UE_LOG(LogTemp, Warning, TEXT("Location: %s"), *Location.ToString());
 			
-			if (LocationDataFragment.HitResultAsync.IsValid() && !LocationDataFragment.bTraceResultIn && LocationDataFragment.bShouldRecheckNav)
+			// Grid data is refreshed every frame so queries filter on current positions, staying in the same cell is only a few writes
+			FSmbGridEntityData GridData;
+			GridData.Location = FVector3f(Location);
+			GridData.Radius = AgentRadiusArrayView.Num() > 0 ? AgentRadiusArrayView[EntityIndex].Radius : 0.f;
+			GridData.Team = TeamArrayView.Num() > 0 ? TeamArrayView[EntityIndex].TeamID : FSmbSpatialGrid::NoTeam;
+			if (DefenceArrayView.Num() > 0)
 			{
-				LocationDataFragment.bTraceResultIn = true;
-				FTraceDatum Datum;
-				GetWorld()->QueryTraceData(LocationDataFragment.HitResultAsync,Datum);
-				FMassMoveTargetFragment& MoveTargetFragment = MoveTargetFragmentArrayView[EntityIndex];
-				if (Datum.OutHits.Num() >= 1)
-				{
-					if (FMath::Abs(Location.Z - Datum.OutHits[0].ImpactPoint.Z) >= 20.f/LocationDataFragment.TraceDistMulti )
-					{
-						LocationDataFragment.bNewLocation = true;
-						EntitiesToSignal.Add(Context.GetEntity(EntityIndex));
-						LocationDataFragment.TimeSince += (LocationDataFragment.BaseRefresh/10)*LocationDataFragment.TraceDistMulti;
-						LocationDataFragment.TraceDistMulti = FMath::Clamp(LocationDataFragment.TraceDistMulti*2.5f,0.22f,4.0f);
-					}
-					else // Trace was close enough didn't have to move
-					{ 
-						LocationDataFragment.TraceDistMulti = FMath::Clamp(LocationDataFragment.TraceDistMulti/2.5f,0.22f,4.0f);
-					}
-					//MoveTargetFragment.Center = Datum.OutHits.Last().ImpactPoint;
-				} else // Didn't find anything in trace
-				{
-					LocationDataFragment.TraceDistMulti = FMath::Clamp(LocationDataFragment.TraceDistMulti*3.0f,0.22f,4.0f);
-					LocationDataFragment.TimeSince += (LocationDataFragment.BaseRefresh/10)*LocationDataFragment.TraceDistMulti;
-				}
+				GridData.bDamageable = true;
+				GridData.bAlive = DefenceArrayView[EntityIndex].HP > 0;
+				GridData.Health = DefenceArrayView[EntityIndex].HP;
 			}
-			
-			LocationDataFragment.TimeSince += DeltaTime;
-			if (LocationDataFragment.TimeSince < LocationDataFragment.BaseRefresh) continue;
+			SmbSubsystem.UpdateGridEntity(Context.GetEntity(EntityIndex), GridData, GridMoves);
 
-			if (LocationDataFragment.bShouldRecheckNav)
-			{
-				LocationDataFragment.HitResultAsync = GetWorld()->AsyncLineTraceByChannel(
-					EAsyncTraceType::Single,
-					Location+FVector::UpVector*455.f*LocationDataFragment.TraceDistMulti,
-					Location+FVector::UpVector*-650.f*LocationDataFragment.TraceDistMulti,
-					ECollisionChannel::ECC_WorldStatic);
-				LocationDataFragment.bTraceResultIn = false;
-			}
+			LocationDataFragment.TimeSince += FMath::Min(GetEntityDeltaTime(VariableTickView, EntityIndex, DeltaTime), 0.2f);
+			if (LocationDataFragment.TimeSince < LocationParams.BaseRefresh) continue;
+			FLocationTargetFragment& LocationTargetFragment = LocationTargetFragmentArrayView[EntityIndex];
 
 			// If Entities didn't move on average last checks, set animation to walk.
 			LocationDataFragment.ExponentialMove /= 1.2f;
@@ -281,37 +314,294 @@ void URegisterProcessor::Execute(FMassEntityManager& EntityManager, FMassExecuti
 				}
 				if (LocationDataFragment.DidNotMoveStreak >= 2)
 				{
-					if (LocationDataFragment.PrevWalkToLocationBeforeAttack != FVector::ZeroVector &&
-						(LocationDataFragment.PrevWalkToLocationBeforeAttack-Transform.GetLocation()).Size() > 200.f)
+					if (LocationTargetFragment.PrevWalkToLocationBeforeAttack != FVector::ZeroVector &&
+						(LocationTargetFragment.PrevWalkToLocationBeforeAttack-Transform.GetLocation()).Size() > 200.f)
 					{
-						LocationDataFragment.bIsAttackLocation = false;
-						LocationDataFragment.WalkToLocation = LocationDataFragment.PrevWalkToLocationBeforeAttack;
+						LocationTargetFragment.bIsAttackLocation = false;
+						LocationTargetFragment.WalkToLocation = LocationTargetFragment.PrevWalkToLocationBeforeAttack;
 					}
 					AnimFrag.CurrentState = EAnimationState::Idle;
-					LocationDataFragment.WalkToLocation = Transform.GetLocation();
+					LocationTargetFragment.WalkToLocation = Transform.GetLocation();
 				}
 			} else
 			{
 				LocationDataFragment.DidNotMoveStreak = 0;
 			}
-			FMassEntityHandle EntityHandle = Context.GetEntity(EntityIndex);
-			FVector NewOldLocation = SmbSubsystem.RegisterToGrid(Location,
-				EntityHandle,
-				LocationDataFragment.OldLocation);
-			LocationDataFragment.OldLocation = NewOldLocation;
+
+			// Idle entities that neither walk nor get pushed stop registering and colliding, their grid entry stays where it is
+			const bool bStill = LocationParams.bCanSleep && !LocationTargetFragment.bNewLocation
+				&& AnimationFragmentArrayView[EntityIndex].CurrentState == EAnimationState::Idle
+				&& LocationDataFragment.ExponentialMove <= LocationParams.SleepMoveThreshold
+				&& (CollisionArrayView.Num() == 0 || CollisionArrayView[EntityIndex].RecentPush <= LocationParams.SleepMoveThreshold);
+			LocationDataFragment.StillRefreshes = bStill ? LocationDataFragment.StillRefreshes + 1 : 0;
+			if (LocationDataFragment.StillRefreshes >= LocationParams.RefreshesBeforeSleep)
+			{
+				// Sleepers are never refreshed, so whichever path wakes them starts counting from zero again
+				LocationDataFragment.StillRefreshes = 0;
+				Context.Defer().AddTag<FSmbSleepingTag>(Context.GetEntity(EntityIndex));
+			}
+			LocationDataFragment.OldLocation = Location;
+			
+			LocationDataFragment.TimeSince = 0.f+RandomStream.FRandRange(0.f,LocationParams.BaseRefresh*0.3f);
+		}
+		SmbSubsystem.QueueGridMoves(GridMoves);
+	});
+
+	if (USmbSubsystem* SmbSubsystem = GetWorld()->GetSubsystem<USmbSubsystem>())
+	{
+		SmbSubsystem->FlushGridMoves();
+		SmbSubsystem->PublishGridSnapshot();
+	}
+}
+
+USleeperRefreshProcessor::USleeperRefreshProcessor()
+	:EntityQuery(*this)
+{
+	bAutoRegisterWithProcessingPhases = true;
+	ExecutionFlags = (int32)(EProcessorExecutionFlags::AllNetModes);
+	ExecutionOrder.ExecuteBefore.Add(UE::Mass::ProcessorGroupNames::Movement);
+}
+
+void USleeperRefreshProcessor::ConfigureQueries(const TSharedRef<FMassEntityManager>& EntityManager)
+{
+	EntityQuery.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddRequirement<FLocationDataFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddRequirement<FDefenceFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddRequirement<FAgentRadiusFragment>(EMassFragmentAccess::ReadOnly, EMassFragmentPresence::Optional);
+	EntityQuery.AddRequirement<FTeamFragment>(EMassFragmentAccess::ReadOnly, EMassFragmentPresence::Optional);
+	EntityQuery.AddTagRequirement<FSmbSleepingTag>(EMassFragmentPresence::All);
+	EntityQuery.AddSubsystemRequirement<USmbSubsystem>(EMassFragmentAccess::ReadWrite);
+}
+
+void USleeperRefreshProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	TimeSinceRefresh += Context.GetDeltaTimeSeconds();
+	if (TimeSinceRefresh < RefreshPeriod) return;
+	TimeSinceRefresh = 0.f;
+
+	// Same grid data URegisterProcessor writes for awake entities, an unchanged sleeper costs one compare
+	EntityQuery.ParallelForEachEntityChunk(Context, [](FMassExecutionContext& Context)
+	{
+		USmbSubsystem& SmbSubsystem = Context.GetMutableSubsystemChecked<USmbSubsystem>();
+		TConstArrayView<FTransformFragment> TransformFragmentArrayView = Context.GetFragmentView<FTransformFragment>();
+		TConstArrayView<FDefenceFragment> DefenceArrayView = Context.GetFragmentView<FDefenceFragment>();
+		TConstArrayView<FAgentRadiusFragment> AgentRadiusArrayView = Context.GetFragmentView<FAgentRadiusFragment>();
+		TConstArrayView<FTeamFragment> TeamArrayView = Context.GetFragmentView<FTeamFragment>();
+
+		TArray<FSmbGridMove> GridMoves;
+		for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
+		{
+			FSmbGridEntityData GridData;
+			GridData.Location = FVector3f(TransformFragmentArrayView[EntityIndex].GetTransform().GetLocation());
+			GridData.Radius = AgentRadiusArrayView.Num() > 0 ? AgentRadiusArrayView[EntityIndex].Radius : 0.f;
+			GridData.Team = TeamArrayView.Num() > 0 ? TeamArrayView[EntityIndex].TeamID : FSmbSpatialGrid::NoTeam;
+			GridData.bDamageable = true;
+			GridData.bAlive = DefenceArrayView[EntityIndex].HP > 0;
+			GridData.Health = DefenceArrayView[EntityIndex].HP;
+			SmbSubsystem.UpdateGridEntity(Context.GetEntity(EntityIndex), GridData, GridMoves);
+		}
+		SmbSubsystem.QueueGridMoves(GridMoves);
+	});
+
+	if (USmbSubsystem* SmbSubsystem = GetWorld()->GetSubsystem<USmbSubsystem>())
+	{
+		SmbSubsystem->FlushGridMoves();
+	}
+}
+
+UNavRecheckProcessor::UNavRecheckProcessor()
+	:EntityQuery(*this)
+{
+	bAutoRegisterWithProcessingPhases = true;
+	ExecutionFlags = (int32)(EProcessorExecutionFlags::AllNetModes);
+	ExecutionOrder.ExecuteBefore.Add(UE::Mass::ProcessorGroupNames::Movement);
+	ExecutionOrder.ExecuteBefore.Add(URegisterProcessor::StaticClass()->GetFName());
+	// Completing and launching the trace batch is game thread only, the chunks still run in parallel
+	bRequiresGameThreadExecution = true;
+}
+
+void UNavRecheckProcessor::ConfigureQueries(const TSharedRef<FMassEntityManager>& EntityManager)
+{
+	EntityQuery.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddRequirement<FLocationDataFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddRequirement<FLocationTargetFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddConstSharedRequirement<FLocationDataParams>();
+	EntityQuery.AddTagRequirement<FSmbNavRecheckTag>(EMassFragmentPresence::All);
+	EntityQuery.AddTagRequirement<FSmbSleepingTag>(EMassFragmentPresence::None);
+	EntityQuery.AddSubsystemRequirement<UMassSignalSubsystem>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddSubsystemRequirement<USmbSubsystem>(EMassFragmentAccess::ReadWrite);
+}
+
+void UNavRecheckProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	float DeltaTime = FMath::Min(Context.GetDeltaTimeSeconds(),0.2f);
+	USmbSubsystem* SmbSubsystem = GetWorld()->GetSubsystem<USmbSubsystem>();
+	if (!SmbSubsystem) return;
+
+	// The last batch is collected without waiting for it. Until it is done the whole pass sits out: its results are read once, by the
+	// pass that collects them, and entities due for a trace queue it on the frame after
+	if (!SmbSubsystem->CompleteGroundTraces()) return;
+
+	EntityQuery.ParallelForEachEntityChunk(Context, [DeltaTime, SmbSubsystem](FMassExecutionContext& Context)
+	{
+		TConstArrayView<FTransformFragment> TransformFragmentArrayView = Context.GetFragmentView<FTransformFragment>();
+		TArrayView<FLocationDataFragment> LocationDataFragmentArrayView = Context.GetMutableFragmentView<FLocationDataFragment>();
+		TArrayView<FLocationTargetFragment> LocationTargetFragmentArrayView = Context.GetMutableFragmentView<FLocationTargetFragment>();
+		const FLocationDataParams& LocationParams = Context.GetConstSharedFragment<FLocationDataParams>();
+		UMassSignalSubsystem& SignalSubsystem = Context.GetMutableSubsystemChecked<UMassSignalSubsystem>();
+
+		TArray<FMassEntityHandle> EntitiesToSignal = TArray<FMassEntityHandle>();
+		TArray<FSmbGroundTrace> Traces;
+		
+		for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
+		{
+			FLocationDataFragment& LocationDataFragment = LocationDataFragmentArrayView[EntityIndex];
+			FLocationTargetFragment& LocationTargetFragment = LocationTargetFragmentArrayView[EntityIndex];
+			const FVector Location = TransformFragmentArrayView[EntityIndex].GetTransform().GetLocation();
+			const FMassEntityHandle Entity = Context.GetEntity(EntityIndex);
+
+			if (const FSmbGroundTrace* Trace = SmbSubsystem->FindGroundTrace(Entity))
+			{
+				if (Trace->bHit)
+				{
+					if (FMath::Abs(Location.Z - Trace->ImpactPoint.Z) >= 20.f/LocationTargetFragment.TraceDistMulti )
+					{
+						LocationTargetFragment.bNewLocation = true;
+						EntitiesToSignal.Add(Entity);
+						LocationDataFragment.TimeSince += (LocationParams.BaseRefresh/10)*LocationTargetFragment.TraceDistMulti;
+						LocationTargetFragment.TraceDistMulti = FMath::Clamp(LocationTargetFragment.TraceDistMulti*2.5f,0.22f,4.0f);
+					}
+					else // Trace was close enough didn't have to move
+					{ 
+						LocationTargetFragment.TraceDistMulti = FMath::Clamp(LocationTargetFragment.TraceDistMulti/2.5f,0.22f,4.0f);
+					}
+				} else // Didn't find anything in trace
+				{
+					LocationTargetFragment.TraceDistMulti = FMath::Clamp(LocationTargetFragment.TraceDistMulti*3.0f,0.22f,4.0f);
+					LocationDataFragment.TimeSince += (LocationParams.BaseRefresh/10)*LocationTargetFragment.TraceDistMulti;
+				}
+			}
 			
-			LocationDataFragment.TimeSince = 0.f+FMath::RandRange(0.f,LocationDataFragment.BaseRefresh*0.3f);
+			// URegisterProcessor adds DeltaTime after this runs, trace on the frame its refresh will go through
+			if (LocationDataFragment.TimeSince + DeltaTime < LocationParams.BaseRefresh) continue;
+
+			FSmbGroundTrace& Trace = Traces.AddDefaulted_GetRef();
+			Trace.Owner = Entity;
+			Trace.Start = Location+FVector::UpVector*455.f*LocationTargetFragment.TraceDistMulti;
+			Trace.End = Location+FVector::UpVector*-650.f*LocationTargetFragment.TraceDistMulti;
 		}
+		SmbSubsystem->QueueGroundTraces(Traces);
 		if (EntitiesToSignal.Num() > 0)
 		{
 			//UE_LOG(LogMass, Display, TEXT("Told %i Entities to recheck move"),EntitiesToSignal.Num());
 			SignalSubsystem.SignalEntitiesDeferred(Context,Smb::Signals::MoveTargetChanged,EntitiesToSignal);
 		}
 	});
+
+	SmbSubsystem->LaunchGroundTraces();
 }
 
 
 
+namespace
+{
+	constexpr int32 CollisionLaneWidth = 4;
+	/* Lightest mass a side of a pair is weighted with, massless entities would get an infinite push */
+	constexpr float MinCollisionMass = UE_KINDA_SMALL_NUMBER;
+
+	/* Neighbours of one entity laid out per component so four of them resolve in one register.
+	 * Offsets point from the neighbour to the entity, unused lanes stay zero and never push. */
+	template<int32 LaneCount>
+	struct TCollisionLanes
+	{
+		alignas(16) float OffsetX[LaneCount];
+		alignas(16) float OffsetY[LaneCount];
+		alignas(16) float OffsetZ[LaneCount];
+		alignas(16) float Radius[LaneCount];
+		alignas(16) float Mass[LaneCount];
+	};
+
+	/* How far along its lane offset each side of a pair is pushed, zero when the pair does not overlap */
+	template<int32 LaneCount>
+	struct TCollisionPushScales
+	{
+		alignas(16) float Self[LaneCount];
+		alignas(16) float Other[LaneCount];
+	};
+
+	/* Push scales for both sides of every lane, each side weighted by the mass of the other.
+	 * Matches the per neighbour GetSafeNormal push, platforms without vector intrinsics run the same code through the FPU fallback. */
+	template<int32 LaneCount>
+	void ResolveCollisionLanes(const TCollisionLanes<LaneCount>& Lanes, float SelfRadius, float SelfMass, float PushStep, TCollisionPushScales<LaneCount>& OutScales)
+	{
+		static_assert(LaneCount % CollisionLaneWidth == 0, "Collision lanes are resolved a full register at a time");
+		const VectorRegister4Float SelfRadiusV = VectorSetFloat1(SelfRadius);
+		const float SafeSelfMass = FMath::Max(SelfMass, MinCollisionMass);
+		const VectorRegister4Float SelfMassV = VectorSetFloat1(SafeSelfMass);
+		const VectorRegister4Float InvSelfMassV = VectorSetFloat1(1.f / SafeSelfMass);
+		const VectorRegister4Float MinMassV = VectorSetFloat1(MinCollisionMass);
+		const VectorRegister4Float HalfV = VectorSetFloat1(0.5f);
+		const VectorRegister4Float StepV = VectorSetFloat1(PushStep);
+		const VectorRegister4Float SmallV = VectorSetFloat1(UE_SMALL_NUMBER);
+
+		for (int32 Lane = 0; Lane < LaneCount; Lane += CollisionLaneWidth)
+		{
+			const VectorRegister4Float X = VectorLoadAligned(&Lanes.OffsetX[Lane]);
+			const VectorRegister4Float Y = VectorLoadAligned(&Lanes.OffsetY[Lane]);
+			const VectorRegister4Float Z = VectorLoadAligned(&Lanes.OffsetZ[Lane]);
+			// Unused lanes are zero too, they are masked out below but must not divide by zero either
+			const VectorRegister4Float Mass = VectorMax(VectorLoadAligned(&Lanes.Mass[Lane]), MinMassV);
+			const VectorRegister4Float DistSq = VectorMultiplyAdd(X, X, VectorMultiplyAdd(Y, Y, VectorMultiply(Z, Z)));
+			const VectorRegister4Float Reach = VectorAdd(SelfRadiusV, VectorLoadAligned(&Lanes.Radius[Lane]));
+
+			// Overlapping and far enough apart to have a direction, same cutoff GetSafeNormal uses
+			const VectorRegister4Float Mask = VectorBitwiseAnd(
+				VectorCompareLE(DistSq, VectorMultiply(Reach, Reach)),
+				VectorCompareGT(DistSq, SmallV));
+			const VectorRegister4Float Step = VectorMultiply(VectorReciprocalSqrt(VectorMax(DistSq, SmallV)), StepV);
+			const VectorRegister4Float SelfWeight = VectorMultiplyAdd(Mass, InvSelfMassV, HalfV);
+			const VectorRegister4Float OtherWeight = VectorAdd(VectorDivide(SelfMassV, Mass), HalfV);
+
+			VectorStoreAligned(VectorSelect(Mask, VectorMultiply(Step, SelfWeight), VectorZeroFloat()), &OutScales.Self[Lane]);
+			VectorStoreAligned(VectorSelect(Mask, VectorMultiply(Step, OtherWeight), VectorZeroFloat()), &OutScales.Other[Lane]);
+		}
+	}
+
+	template<typename FragmentType>
+	constexpr int32 CollisionCapacityOf = decltype(FragmentType::Neighbors)::Capacity;
+
+	/* Calls Visitor with the neighbour fragments of the chunk, whichever ESmbCollisionCapacity its archetype was built with */
+	template<typename VisitorType>
+	void VisitCollisionNeighbors(FMassExecutionContext& Context, VisitorType&& Visitor)
+	{
+		if (TArrayView<FCollisionNeighbors2Fragment> View2 = Context.GetMutableFragmentView<FCollisionNeighbors2Fragment>(); View2.Num() > 0)
+		{
+			Visitor(View2);
+		}
+		else if (TArrayView<FCollisionNeighbors4Fragment> View4 = Context.GetMutableFragmentView<FCollisionNeighbors4Fragment>(); View4.Num() > 0)
+		{
+			Visitor(View4);
+		}
+		else if (TArrayView<FCollisionNeighbors8Fragment> View8 = Context.GetMutableFragmentView<FCollisionNeighbors8Fragment>(); View8.Num() > 0)
+		{
+			Visitor(View8);
+		}
+		else if (TArrayView<FCollisionNeighbors16Fragment> View16 = Context.GetMutableFragmentView<FCollisionNeighbors16Fragment>(); View16.Num() > 0)
+		{
+			Visitor(View16);
+		}
+	}
+
+	TConstArrayView<FMassEntityHandle> GetCollisionNeighbors(const FMassEntityView& EntityView)
+	{
+		if (const FCollisionNeighbors2Fragment* Fragment = EntityView.GetFragmentDataPtr<FCollisionNeighbors2Fragment>()) return MakeArrayView(Fragment->Neighbors.ClosestEntities);
+		if (const FCollisionNeighbors4Fragment* Fragment = EntityView.GetFragmentDataPtr<FCollisionNeighbors4Fragment>()) return MakeArrayView(Fragment->Neighbors.ClosestEntities);
+		if (const FCollisionNeighbors8Fragment* Fragment = EntityView.GetFragmentDataPtr<FCollisionNeighbors8Fragment>()) return MakeArrayView(Fragment->Neighbors.ClosestEntities);
+		if (const FCollisionNeighbors16Fragment* Fragment = EntityView.GetFragmentDataPtr<FCollisionNeighbors16Fragment>()) return MakeArrayView(Fragment->Neighbors.ClosestEntities);
+		return TConstArrayView<FMassEntityHandle>();
+	}
+}
+
 UCollisionProcessor::UCollisionProcessor()
 	:EntityQuery(*this)
 {
@@ -326,66 +616,226 @@ void UCollisionProcessor::ConfigureQueries(const TSharedRef<FMassEntityManager>&
 
 	EntityQuery.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadWrite);
 	EntityQuery.AddRequirement<FCollisionDataFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddConstSharedRequirement<FCollisionParams>();
 	EntityQuery.AddRequirement<FAgentRadiusFragment>(EMassFragmentAccess::ReadWrite);
-	EntityQuery.AddSubsystemRequirement<USmbSubsystem>(EMassFragmentAccess::ReadWrite);
+	// Only read through the neighbour snapshot, declared so the scheduler knows this processor reads other entities' velocity
+	EntityQuery.AddRequirement<FMassVelocityFragment>(EMassFragmentAccess::ReadOnly, EMassFragmentPresence::Optional);
+	EntityQuery.AddRequirement<FCollisionNeighbors2Fragment>(EMassFragmentAccess::ReadWrite, EMassFragmentPresence::Any);
+	EntityQuery.AddRequirement<FCollisionNeighbors4Fragment>(EMassFragmentAccess::ReadWrite, EMassFragmentPresence::Any);
+	EntityQuery.AddRequirement<FCollisionNeighbors8Fragment>(EMassFragmentAccess::ReadWrite, EMassFragmentPresence::Any);
+	EntityQuery.AddRequirement<FCollisionNeighbors16Fragment>(EMassFragmentAccess::ReadWrite, EMassFragmentPresence::Any);
+	EntityQuery.AddTagRequirement<FSmbSleepingTag>(EMassFragmentPresence::None);
+	AddVariableTickRequirements(EntityQuery);
+	EntityQuery.AddSubsystemRequirement<USmbSubsystem>(EMassFragmentAccess::ReadOnly);
 }
 
 void UCollisionProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
 {
 	float DeltaTime = FMath::Min(Context.GetDeltaTimeSeconds(),0.2f);
 
-	EntityQuery.ParallelForEachEntityChunk(Context, [this, DeltaTime](FMassExecutionContext& Context)
+	// Entities due for a neighbour refresh only queue their question, all of them are answered together per cell
+	NeighborQueries.Reset();
+	EntityQuery.ForEachEntityChunk(Context, [this, DeltaTime](FMassExecutionContext& Context)
 	{
-		USmbSubsystem& SmbSubsystem = Context.GetMutableSubsystemChecked<USmbSubsystem>();
-		TArrayView<FTransformFragment> TransformFragmentArrayView = Context.GetMutableFragmentView<FTransformFragment>();
+		int32 Capacity = 0;
+		VisitCollisionNeighbors(Context, [&Capacity](auto NeighborsView)
+		{
+			Capacity = CollisionCapacityOf<typename decltype(NeighborsView)::ElementType>;
+		});
+		TConstArrayView<FTransformFragment> TransformFragmentArrayView = Context.GetFragmentView<FTransformFragment>();
 		TArrayView<FCollisionDataFragment> CollisionDataFragmentArrayView = Context.GetMutableFragmentView<FCollisionDataFragment>();
-		TArrayView<FAgentRadiusFragment> AgentRadiusFragmentArrayView = Context.GetMutableFragmentView<FAgentRadiusFragment>();
+		const FCollisionParams& CollisionParams = Context.GetConstSharedFragment<FCollisionParams>();
+		TConstArrayView<FAgentRadiusFragment> AgentRadiusFragmentArrayView = Context.GetFragmentView<FAgentRadiusFragment>();
+		TConstArrayView<FMassSimulationVariableTickFragment> VariableTickView = Context.GetFragmentView<FMassSimulationVariableTickFragment>();
+		FRandomStream RandomStream = MakeChunkRandomStream(Context);
 		for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
 		{
 			FCollisionDataFragment& CollisionDataFragment = CollisionDataFragmentArrayView[EntityIndex];
-			FTransform& MutableTransform = TransformFragmentArrayView[EntityIndex].GetMutableTransform();
-			FVector Location = MutableTransform.GetLocation();
-			FAgentRadiusFragment& AgentRadiusFragment = AgentRadiusFragmentArrayView[EntityIndex];
-			
-			CollisionDataFragment.TimeSinceLastCheck += DeltaTime*FMath::RandRange(0.8f,1.2f);
-			if (!(CollisionDataFragment.TimeSinceLastCheck <= CollisionDataFragment.CheckDelay))
-			{
-				TArray<FMassEntityHandle> Handles = SmbSubsystem.GetNumberClosestEntities(Location,
-					AgentRadiusFragment.Radius*2.1f,
-					CollisionDataFragment.MaxEntitiesToCheck);
-				TStaticArray<FMassEntityHandle, COLLISION_ARR_SIZE> StaticHandlesArray;
-				for (int i = 0; i < FMath::Min(COLLISION_ARR_SIZE,Handles.Num()); ++i)
+			CollisionDataFragment.TimeSinceLastCheck += GetEntityDeltaTime(VariableTickView, EntityIndex, DeltaTime)*RandomStream.FRandRange(0.8f,1.2f);
+			if (CollisionDataFragment.TimeSinceLastCheck <= CollisionParams.CheckDelay) continue;
+			NeighborQueries.Add(Context.GetEntity(EntityIndex),
+				TransformFragmentArrayView[EntityIndex].GetTransform().GetLocation(),
+				AgentRadiusFragmentArrayView[EntityIndex].Radius*2.1f,
+				FMath::Clamp(CollisionParams.MaxEntitiesToCheck, 0, Capacity));
+			CollisionDataFragment.TimeSinceLastCheck = 0;
+		}
+	});
+	if (NeighborQueries.Num() > 0)
+	{
+		GetWorld()->GetSubsystem<USmbSubsystem>()->ResolveNeighborQueries(NeighborQueries);
+	}
+
+	EntityQuery.ParallelForEachEntityChunk(Context, [this](FMassExecutionContext& Context)
+	{
+		VisitCollisionNeighbors(Context, [this, &Context](auto NeighborsView)
+		{
+			for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
+			{
+				const FSmbNeighborQuery* Query = NeighborQueries.Find(Context.GetEntity(EntityIndex));
+				if (!Query) continue;
+				auto& ClosestEntities = NeighborsView[EntityIndex].Neighbors.ClosestEntities;
+				TConstArrayView<FMassEntityHandle> Found = NeighborQueries.GetResults(*Query);
+				for (int32 i = 0; i < ClosestEntities.Num(); ++i)
 				{
-					if (Handles[i].IsValid())
-						StaticHandlesArray[i] = Handles[i];
+					ClosestEntities[i] = i < Found.Num() ? Found[i] : FMassEntityHandle();
 				}
-				//UE_LOG(LogTemp, Warning, TEXT("Closest Entities: %d"), Handles.Num());
-				CollisionDataFragment.ClosestEntities = StaticHandlesArray;
-				CollisionDataFragment.TimeSinceLastCheck = 0;
 			}
-			FMassEntityManager& EntityManager = Context.GetEntityManagerChecked();
-			for (FMassEntityHandle Handle : CollisionDataFragment.ClosestEntities)
-			{
-				if (!EntityManager.IsEntityValid(Handle)) continue;
-				FTransformFragment* TransformFrag = EntityManager.GetFragmentDataPtr<FTransformFragment>(Handle);
-				if (!TransformFrag) continue;
-				FAgentRadiusFragment* OtherRadius = EntityManager.GetFragmentDataPtr<FAgentRadiusFragment>(Handle);
-				if (!OtherRadius) continue;
-				FVector OtherLocation = TransformFrag->GetTransform().GetLocation();
-				float Distance = (Location - OtherLocation).Size();
-				if (Distance <= AgentRadiusFragment.Radius+OtherRadius->Radius)
+		});
+	});
+
+	// Snapshot the refreshed neighbours once the lists are final, this is the only pass that reads other entities
+	if (NeighborQueries.Num() > 0)
+	{
+		EntityQuery.ParallelForEachEntityChunk(Context, [this](FMassExecutionContext& Context)
+		{
+			const FMassEntityManager& EntityManager = Context.GetEntityManagerChecked();
+			VisitCollisionNeighbors(Context, [this, &Context, &EntityManager](auto NeighborsView)
+			{
+				for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
+				{
+					const FMassEntityHandle Self = Context.GetEntity(EntityIndex);
+					if (!NeighborQueries.Find(Self)) continue;
+					auto& Neighbors = NeighborsView[EntityIndex].Neighbors;
+					Neighbors.OwnedMask = 0;
+					Neighbors.SharedMask = 0;
+					Neighbors.Age = 0.f;
+					for (int32 i = 0; i < Neighbors.Capacity; ++i)
+					{
+						const FMassEntityHandle Handle = Neighbors.ClosestEntities[i];
+						if (Handle == Self || !EntityManager.IsEntityValid(Handle)) continue;
+						const FMassEntityView OtherView(EntityManager, Handle);
+						const FTransformFragment* TransformFrag = OtherView.GetFragmentDataPtr<FTransformFragment>();
+						const FAgentRadiusFragment* OtherRadius = OtherView.GetFragmentDataPtr<FAgentRadiusFragment>();
+						const FCollisionParams* OtherCollisionParams = OtherView.GetConstSharedFragmentDataPtr<FCollisionParams>();
+						if (!TransformFrag || !OtherRadius || !OtherCollisionParams) continue;
+
+						// A pair listed from both sides belongs to the lower index only when both lists were refreshed just now, then the
+						// other side is known to resolve it this frame. An older list on the other side may be stale or its chunk may be
+						// skipped by LOD, so both sides resolve the pair with half the push. One sided pairs and sleepers go to the side that lists them.
+						if (!OtherView.HasTag<FSmbSleepingTag>() && GetCollisionNeighbors(OtherView).Contains(Self))
+						{
+							if (NeighborQueries.Find(Handle))
+							{
+								if (Handle.Index < Self.Index) continue;
+							}
+							else
+							{
+								Neighbors.SharedMask |= 1u << i;
+							}
+						}
+						const FMassVelocityFragment* OtherVelocity = OtherView.GetFragmentDataPtr<FMassVelocityFragment>();
+						Neighbors.Locations[i] = FVector3f(TransformFrag->GetTransform().GetLocation());
+						Neighbors.Velocities[i] = OtherVelocity ? FVector3f(OtherVelocity->Value) : FVector3f::ZeroVector;
+						Neighbors.Radii[i] = OtherRadius->Radius;
+						Neighbors.Masses[i] = OtherCollisionParams->CollisionMass;
+						Neighbors.OwnedMask |= 1u << i;
+					}
+				}
+			});
+		});
+	}
+
+	// Every frame only the entity's own fragment is read, neighbours come from the extrapolated snapshot
+	EntityQuery.ParallelForEachEntityChunk(Context, [this, DeltaTime](FMassExecutionContext& Context)
+	{
+		TConstArrayView<FTransformFragment> TransformFragmentArrayView = Context.GetFragmentView<FTransformFragment>();
+		const FCollisionParams& CollisionParams = Context.GetConstSharedFragment<FCollisionParams>();
+		TConstArrayView<FAgentRadiusFragment> AgentRadiusFragmentArrayView = Context.GetFragmentView<FAgentRadiusFragment>();
+		TConstArrayView<FMassSimulationVariableTickFragment> VariableTickView = Context.GetFragmentView<FMassSimulationVariableTickFragment>();
+		TArray<TPair<FMassEntityHandle, FVector>> ChunkPushes;
+		VisitCollisionNeighbors(Context, [&](auto NeighborsView)
+		{
+			constexpr int32 Capacity = CollisionCapacityOf<typename decltype(NeighborsView)::ElementType>;
+			constexpr int32 LaneCount = Align(Capacity, CollisionLaneWidth);
+			for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
+			{
+				auto& Neighbors = NeighborsView[EntityIndex].Neighbors;
+				if (Neighbors.OwnedMask == 0) continue;
+				const FVector Location = TransformFragmentArrayView[EntityIndex].GetTransform().GetLocation();
+				const float EntityDeltaTime = FMath::Min(GetEntityDeltaTime(VariableTickView, EntityIndex, DeltaTime), 0.2f);
+
+				TCollisionLanes<LaneCount> Lanes = {};
+				for (int32 i = 0; i < Capacity; ++i)
+				{
+					if (!(Neighbors.OwnedMask & (1u << i))) continue;
+					const FVector Offset = Location - Neighbors.GetPredictedLocation(i);
+					Lanes.OffsetX[i] = Offset.X;
+					Lanes.OffsetY[i] = Offset.Y;
+					Lanes.OffsetZ[i] = Offset.Z;
+					Lanes.Radius[i] = Neighbors.Radii[i];
+					Lanes.Mass[i] = Neighbors.Masses[i];
+				}
+				Neighbors.Age += EntityDeltaTime;
+
+				TCollisionPushScales<LaneCount> Scales;
+				ResolveCollisionLanes(Lanes, AgentRadiusFragmentArrayView[EntityIndex].Radius,
+					CollisionParams.CollisionMass, EntityDeltaTime*80.f, Scales);
+				FVector SelfPushed = FVector::ZeroVector;
+				for (int32 i = 0; i < Capacity; ++i)
+				{
+					if (Scales.Self[i] == 0.f) continue;
+					const float Share = (Neighbors.SharedMask & (1u << i)) ? 0.5f : 1.f;
+					const FVector Direction(Lanes.OffsetX[i], Lanes.OffsetY[i], 0.f);
+					SelfPushed += Direction * (Scales.Self[i] * Share);
+					ChunkPushes.Emplace(Neighbors.ClosestEntities[i], Direction * (-Scales.Other[i] * Share));
+				}
+				if (!SelfPushed.IsZero())
 				{
-					FCollisionDataFragment* OtherCollisionData = EntityManager.GetFragmentDataPtr<FCollisionDataFragment>(Handle);
-					if (!OtherCollisionData) continue;
-					float WeightMulti = 0.5f + OtherCollisionData->CollisionMass / CollisionDataFragment.CollisionMass;
-					FVector SelfPushed = (Location - OtherLocation).GetSafeNormal() * WeightMulti * DeltaTime*80.f;
-					SelfPushed.Z = 0.f;
-					//UE_LOG(LogTemp, Warning, TEXT("Pushing: %s"), *SelfPushed.ToString());
-					MutableTransform.SetLocation(MutableTransform.GetLocation() + SelfPushed);
+					ChunkPushes.Emplace(Context.GetEntity(EntityIndex), SelfPushed);
 				}
 			}
+		});
+		if (ChunkPushes.Num() > 0)
+		{
+			FScopeLock Lock(&PendingPushesLock);
+			PendingPushes.Append(ChunkPushes);
 		}
 	});
+	for (const TPair<FMassEntityHandle, FVector>& Push : PendingPushes)
+	{
+		if (Push.Key.Index >= PushDeltas.Num())
+		{
+			PushDeltas.SetNumZeroed(Push.Key.Index + 1, EAllowShrinking::No);
+		}
+		PushDeltas[Push.Key.Index] += Push.Value;
+	}
+
+	EntityQuery.ParallelForEachEntityChunk(Context, [this, DeltaTime](FMassExecutionContext& Context)
+	{
+		TArrayView<FTransformFragment> TransformFragmentArrayView = Context.GetMutableFragmentView<FTransformFragment>();
+		TArrayView<FCollisionDataFragment> CollisionDataFragmentArrayView = Context.GetMutableFragmentView<FCollisionDataFragment>();
+		TConstArrayView<FMassSimulationVariableTickFragment> VariableTickView = Context.GetFragmentView<FMassSimulationVariableTickFragment>();
+		for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
+		{
+			FCollisionDataFragment& CollisionDataFragment = CollisionDataFragmentArrayView[EntityIndex];
+			CollisionDataFragment.RecentPush *= FMath::Max(1.f - GetEntityDeltaTime(VariableTickView, EntityIndex, DeltaTime), 0.f);
+			const int32 Index = Context.GetEntity(EntityIndex).Index;
+			if (!PushDeltas.IsValidIndex(Index) || PushDeltas[Index].IsZero()) continue;
+			FTransform& MutableTransform = TransformFragmentArrayView[EntityIndex].GetMutableTransform();
+			MutableTransform.SetLocation(MutableTransform.GetLocation() + PushDeltas[Index]);
+			CollisionDataFragment.RecentPush += PushDeltas[Index].Size();
+			PushDeltas[Index] = FVector::ZeroVector;
+		}
+	});
+
+	// Whatever is left was pushed into a sleeper, an entity whose LOD skipped this frame or one that died since its snapshot.
+	// A real push wakes the sleeper, the skipped entity keeps it for its next tick and the rest is dropped.
+	for (const TPair<FMassEntityHandle, FVector>& Push : PendingPushes)
+	{
+		FVector& Delta = PushDeltas[Push.Key.Index];
+		if (Delta.IsZero()) continue;
+		if (EntityManager.IsEntityValid(Push.Key))
+		{
+			const FMassEntityView PushedView(EntityManager, Push.Key);
+			if (!PushedView.HasTag<FSmbSleepingTag>()) continue;
+			if (Delta.SizeSquared() > FMath::Square(SleepWakePush))
+			{
+				Context.Defer().RemoveTag<FSmbSleepingTag>(Push.Key);
+			}
+		}
+		Delta = FVector::ZeroVector;
+	}
+	PendingPushes.Reset();
 }
 
 ULocateEnemy::ULocateEnemy()
@@ -402,58 +852,162 @@ void ULocateEnemy::ConfigureQueries(const TSharedRef<FMassEntityManager>& Entity
 
 	EntityQuery.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadWrite);
 	EntityQuery.AddRequirement<FNearEnemiesFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddConstSharedRequirement<FNearEnemiesParams>();
 	EntityQuery.AddRequirement<FTeamFragment>(EMassFragmentAccess::ReadWrite);
-	EntityQuery.AddSubsystemRequirement<USmbSubsystem>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddRequirement<FMassSimulationLODFragment>(EMassFragmentAccess::ReadOnly, EMassFragmentPresence::Optional);
+	EntityQuery.AddChunkRequirement<FSmbEnemyCheckChunkFragment>(EMassFragmentAccess::ReadWrite);
+	// Chunks of other slots are skipped without touching their entities, chunks visited this frame pass again for the apply pass
+	EntityQuery.SetChunkFilter([this](const FMassExecutionContext& Context)
+	{
+		const FSmbEnemyCheckChunkFragment& ChunkFragment = Context.GetChunkFragment<FSmbEnemyCheckChunkFragment>();
+		return ChunkFragment.Slot == INDEX_NONE || ChunkFragment.Slot == CurrentSlot || ChunkFragment.LastVisitFrame == FrameCounter;
+	});
+	EntityQuery.AddSubsystemRequirement<USmbSubsystem>(EMassFragmentAccess::ReadOnly);
 	EntityQuery.AddSubsystemRequirement<UMassSignalSubsystem>(EMassFragmentAccess::ReadWrite);
 }
 
 void ULocateEnemy::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
 {
 	float DeltaTime = FMath::Min(Context.GetDeltaTimeSeconds(),0.1f);
-	
-	EntityQuery.ParallelForEachEntityChunk(Context, [DeltaTime](FMassExecutionContext& Context)
+	const int32 NumSlots = FMath::Max(NumFrameSlots, 1);
+	++FrameCounter;
+	CurrentSlot = FrameCounter % NumSlots;
+	const double Now = GetWorld()->GetTimeSeconds();
+	USmbSubsystem* SmbSubsystem = GetWorld()->GetSubsystem<USmbSubsystem>();
+
+	// Entities due for a check are collected first, the budget then goes to the most overdue of them so the
+	// chunks walked first don't take it every round. The others keep counting and rank higher next time.
+	struct FEnemyCheckCandidate
+	{
+		FMassEntityHandle Entity;
+		FVector Location;
+		float Radius;
+		int32 MaxResults;
+		int32 TeamID;
+		float Overdue;
+	};
+	TArray<FEnemyCheckCandidate> Candidates;
+	NeighborQueries.Reset();
+	EntityQuery.ForEachEntityChunk(Context, [this, DeltaTime, NumSlots, Now, SmbSubsystem, &Candidates](FMassExecutionContext& Context)
+	{
+		FSmbEnemyCheckChunkFragment& ChunkFragment = Context.GetMutableChunkFragment<FSmbEnemyCheckChunkFragment>();
+		float Elapsed = DeltaTime;
+		if (ChunkFragment.Slot == INDEX_NONE)
+		{
+			ChunkFragment.Slot = NextChunkSlot;
+			NextChunkSlot = (NextChunkSlot + 1) % NumSlots;
+		}
+		else
+		{
+			Elapsed = FMath::Min(float(Now - ChunkFragment.LastVisitTime), DeltaTime*NumSlots);
+		}
+		ChunkFragment.LastVisitFrame = FrameCounter;
+		ChunkFragment.LastVisitTime = Now;
+
+		TConstArrayView<FTransformFragment> TransformView = Context.GetFragmentView<FTransformFragment>();
+		TArrayView<FNearEnemiesFragment> NearEnemiesFragmentView = Context.GetMutableFragmentView<FNearEnemiesFragment>();
+		const FNearEnemiesParams& NearEnemiesParams = Context.GetConstSharedFragment<FNearEnemiesParams>();
+		TConstArrayView<FTeamFragment> TeamFragmentView = Context.GetFragmentView<FTeamFragment>();
+		TConstArrayView<FMassSimulationLODFragment> LODView = Context.GetFragmentView<FMassSimulationLODFragment>();
+		TArray<FMassEntityHandle> LostEntities;
+
+		for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
+		{
+			FNearEnemiesFragment& NearEnemiesFragment = NearEnemiesFragmentView[EntityIndex];
+			NearEnemiesFragment.TimeSinceLastCheck += Elapsed;
+			// Every simulation LOD step down doubles the period, the slots already thin chunks out so no variable tick filter on top
+			const float Period = LODView.Num() > 0 ? NearEnemiesParams.CheckPeriod * (1 << LODView[EntityIndex].LOD) : NearEnemiesParams.CheckPeriod;
+			if (NearEnemiesFragment.TimeSinceLastCheck < Period) continue;
+			const FVector Location = TransformView[EntityIndex].GetTransform().GetLocation();
+			// No enemy on the influence map anywhere near means the query can only come back empty
+			if (!SmbSubsystem->HasEnemyInfluence(Location, NearEnemiesParams.CheckRadius, TeamFragmentView[EntityIndex].TeamID))
+			{
+				NearEnemiesFragment.TimeSinceLastCheck = 0.f;
+				if (NearEnemiesFragment.ClosestEnemies.Num() == 0) continue;
+				NearEnemiesFragment.ClosestEnemies.Reset();
+				LostEntities.Add(Context.GetEntity(EntityIndex));
+				continue;
+			}
+			// The timer is reset once the query is answered, an entity left out by the budget keeps its lead
+			Candidates.Add({Context.GetEntity(EntityIndex),
+				Location,
+				NearEnemiesParams.CheckRadius,
+				FMath::Min<int32>(NearEnemiesParams.AmountOfEnemies, FNearEnemiesFragment::MaxTrackedEnemies),
+				TeamFragmentView[EntityIndex].TeamID,
+				NearEnemiesFragment.TimeSinceLastCheck / FMath::Max(Period, UE_KINDA_SMALL_NUMBER)});
+		}
+		if (LostEntities.Num() > 0)
+		{
+			Context.GetMutableSubsystemChecked<UMassSignalSubsystem>().SignalEntitiesDeferred(Context,Smb::Signals::EnemiesLost,LostEntities);
+		}
+	});
+	if (Candidates.Num() > MaxQueriesPerFrame)
+	{
+		Candidates.Sort([](const FEnemyCheckCandidate& A, const FEnemyCheckCandidate& B) { return A.Overdue > B.Overdue; });
+		Candidates.SetNum(FMath::Max(MaxQueriesPerFrame, 0), EAllowShrinking::No);
+	}
+	for (const FEnemyCheckCandidate& Candidate : Candidates)
+	{
+		NeighborQueries.Add(Candidate.Entity, Candidate.Location, Candidate.Radius, Candidate.MaxResults, Candidate.TeamID);
+	}
+	if (NeighborQueries.Num() == 0) return;
+	SmbSubsystem->ResolveNeighborQueries(NeighborQueries);
+
+	EntityQuery.ParallelForEachEntityChunk(Context, [this](FMassExecutionContext& Context)
 	{
-		USmbSubsystem& SmbSubsystem = Context.GetMutableSubsystemChecked<USmbSubsystem>();
 		UMassSignalSubsystem& SignalSubsystem = Context.GetMutableSubsystemChecked<UMassSignalSubsystem>();
-		TArrayView<FTransformFragment> TransformView = Context.GetMutableFragmentView<FTransformFragment>();
 		TArrayView<FNearEnemiesFragment> NearEnemiesFragmentView = Context.GetMutableFragmentView<FNearEnemiesFragment>();
-		TArrayView<FTeamFragment> TeamFragmentView = Context.GetMutableFragmentView<FTeamFragment>();
 
-		TArray<FMassEntityHandle> EntitiesToSignal = TArray<FMassEntityHandle>();
+		TArray<FMassEntityHandle> FoundEntities;
+		TArray<FMassEntityHandle> ChangedEntities;
+		TArray<FMassEntityHandle> LostEntities;
 
 		for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
 		{
+			const FSmbNeighborQuery* Query = NeighborQueries.Find(Context.GetEntity(EntityIndex));
+			if (!Query) continue;
 			FNearEnemiesFragment& NearEnemiesFragment = NearEnemiesFragmentView[EntityIndex];
-			NearEnemiesFragment.TimeSinceLastCheck += DeltaTime;
-			if (NearEnemiesFragment.TimeSinceLastCheck < NearEnemiesFragment.CheckPeriod) continue;
-			auto Prev = NearEnemiesFragment.ClosestEnemies;
-			NearEnemiesFragment.TimeSinceLastCheck = 0.f+FMath::RandRange(0.f,NearEnemiesFragment.CheckPeriod/3);
-			FTransformFragment TransformFragment = TransformView[EntityIndex];
-			FTeamFragment TeamFragment = TeamFragmentView[EntityIndex];
-			NearEnemiesFragment.ClosestEnemies = SmbSubsystem.GetNumberClosestEntities(
-				TransformFragment.GetTransform().GetLocation(),
-				NearEnemiesFragment.CheckRadius,
-				NearEnemiesFragment.AmountOfEnemies,
-				TeamFragment.TeamID);
-			//Call found enemy
-			if (NearEnemiesFragment.ClosestEnemies.Num() > 0)
-			{
-				if (Prev.Num() <= 0)
-				{
-					//SignalSubsystem.SignalEntityDeferred(Context,Smb::Signals::FoundEnemy,Context.GetEntity(EntityIndex));
-					EntitiesToSignal.Add(Context.GetEntity(EntityIndex));
-				}
-				//TSet<FMassEntityHandle> NewSet = TSet<FMassEntityHandle>();
-				//else if (!NearEnemiesFragment.ClosestEnemies.Contains(Prev[0]))
-				//{
-				//	//SignalSubsystem.SignalEntityDeferred(Context,Smb::Signals::FoundEnemy,Context.GetEntity(EntityIndex));
-				//	EntitiesToSignal.Add(Context.GetEntity(EntityIndex));
-				//}
+			NearEnemiesFragment.TimeSinceLastCheck = 0.f;
+			TConstArrayView<FMassEntityHandle> Found = NeighborQueries.GetResults(*Query);
+
+			// Same enemies in the same order leave the fragment untouched and nobody is told
+			if (Found.Num() == NearEnemiesFragment.ClosestEnemies.Num()
+				&& CompareItems(Found.GetData(), NearEnemiesFragment.ClosestEnemies.GetData(), Found.Num())) continue;
+			const FMassEntityHandle PrevClosest = NearEnemiesFragment.ClosestEnemies.Num() > 0 ? NearEnemiesFragment.ClosestEnemies[0] : FMassEntityHandle();
+			NearEnemiesFragment.ClosestEnemies.Reset();
+			NearEnemiesFragment.ClosestEnemies.Append(Found);
+
+			if (Found.Num() == 0)
+			{
+				LostEntities.Add(Context.GetEntity(EntityIndex));
+			}
+			else if (!PrevClosest.IsSet())
+			{
+				FoundEntities.Add(Context.GetEntity(EntityIndex));
+			}
+			else if (Found[0] != PrevClosest)
+			{
+				ChangedEntities.Add(Context.GetEntity(EntityIndex));
 			}
 		}
-		if (EntitiesToSignal.Num() > 0)
+		if (FoundEntities.Num() > 0)
+		{
+			SignalSubsystem.SignalEntitiesDeferred(Context,Smb::Signals::FoundEnemy,FoundEntities);
+		}
+		if (ChangedEntities.Num() > 0)
+		{
+			SignalSubsystem.SignalEntitiesDeferred(Context,Smb::Signals::ClosestEnemyChanged,ChangedEntities);
+		}
+		if (LostEntities.Num() > 0)
+		{
+			SignalSubsystem.SignalEntitiesDeferred(Context,Smb::Signals::EnemiesLost,LostEntities);
+		}
+		if (FoundEntities.Num() > 0 && Context.DoesArchetypeHaveTag<FSmbSleepingTag>())
 		{
-			SignalSubsystem.SignalEntitiesDeferred(Context,Smb::Signals::FoundEnemy,EntitiesToSignal);
+			for (const FMassEntityHandle& Handle : FoundEntities)
+			{
+				Context.Defer().RemoveTag<FSmbSleepingTag>(Handle);
+			}
 		}
 	});
 }
@@ -533,7 +1087,7 @@ void UAddDeathFragmentProcessor::ConfigureQueries(const TSharedRef<FMassEntityMa
 
 	EntityQuery.AddSharedRequirement<FDeathPhysicsSharedFragment>(EMassFragmentAccess::ReadWrite);
 	EntityQuery.AddTagRequirement<FAliveTag>(EMassFragmentPresence::All);
-	EntityQuery.AddRequirement<FLocationDataFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddRequirement<FLocationTargetFragment>(EMassFragmentAccess::ReadWrite);
 	EntityQuery.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadWrite);
 	EntityQuery.AddSubsystemRequirement<USmbSubsystem>(EMassFragmentAccess::ReadOnly);
 }
@@ -544,13 +1098,13 @@ void UAddDeathFragmentProcessor::Execute(FMassEntityManager& EntityManager, FMas
 	{
 		const FDeathPhysicsSharedFragment* DeathPhysFragment = Context.GetMutableSharedFragmentPtr<FDeathPhysicsSharedFragment>();
 		TConstArrayView<FTransformFragment> TransformFragmentView = Context.GetFragmentView<FTransformFragment>();
-		TArrayView<FLocationDataFragment> LocationDataFragmentView = Context.GetMutableFragmentView<FLocationDataFragment>();
+		TArrayView<FLocationTargetFragment> LocationTargetFragmentView = Context.GetMutableFragmentView<FLocationTargetFragment>();
 
 		for (FMassExecutionContext::FEntityIterator EntityIt = Context.CreateEntityIterator(); EntityIt; ++EntityIt)
 		{
 			FTransform Transform = TransformFragmentView[EntityIt].GetTransform();
-			FLocationDataFragment& LocationDataFrag = LocationDataFragmentView[EntityIt];
-			LocationDataFrag.WalkToLocation = Transform.GetLocation();
+			FLocationTargetFragment& LocationTargetFrag = LocationTargetFragmentView[EntityIt];
+			LocationTargetFrag.WalkToLocation = Transform.GetLocation();
 		}
 		
 		USmbSubsystem* SmbSubsystem = Context.GetWorld()->GetSubsystem<USmbSubsystem>();
@@ -566,6 +1120,84 @@ void UAddDeathFragmentProcessor::Execute(FMassEntityManager& EntityManager, FMas
 	});
 }
 
+UStaggerLocationTimersProcessor::UStaggerLocationTimersProcessor()
+	:EntityQuery(*this)
+{
+	ObservedType = FLocationDataFragment::StaticStruct();
+#if ENGINE_MAJOR_VERSION==5 && ENGINE_MINOR_VERSION<7 
+	Operation = EMassObservedOperation::Add;
+#else
+	ObservedOperations = EMassObservedOperationFlags::Add;
+#endif
+}
+
+void UStaggerLocationTimersProcessor::ConfigureQueries(const TSharedRef<FMassEntityManager>& EntityManager)
+{
+	EntityQuery.AddRequirement<FLocationDataFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddConstSharedRequirement<FLocationDataParams>();
+	EntityQuery.AddRequirement<FHeightFragment>(EMassFragmentAccess::ReadWrite, EMassFragmentPresence::Optional);
+	EntityQuery.AddConstSharedRequirement<FHeightParams>(EMassFragmentPresence::Optional);
+	EntityQuery.AddRequirement<FCollisionDataFragment>(EMassFragmentAccess::ReadWrite, EMassFragmentPresence::Optional);
+	EntityQuery.AddConstSharedRequirement<FCollisionParams>(EMassFragmentPresence::Optional);
+}
+
+void UStaggerLocationTimersProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	EntityQuery.ForEachEntityChunk(Context, [](FMassExecutionContext& Context)
+	{
+		TArrayView<FLocationDataFragment> LocationDataFragmentView = Context.GetMutableFragmentView<FLocationDataFragment>();
+		const FLocationDataParams& LocationParams = Context.GetConstSharedFragment<FLocationDataParams>();
+		TArrayView<FHeightFragment> HeightFragmentView = Context.GetMutableFragmentView<FHeightFragment>();
+		const FHeightParams* HeightParams = Context.GetConstSharedFragmentPtr<FHeightParams>();
+		TArrayView<FCollisionDataFragment> CollisionDataFragmentView = Context.GetMutableFragmentView<FCollisionDataFragment>();
+		const FCollisionParams* CollisionParams = Context.GetConstSharedFragmentPtr<FCollisionParams>();
+
+		for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
+		{
+			LocationDataFragmentView[EntityIndex].TimeSince = FMath::FRandRange(0.f, LocationParams.BaseRefresh);
+			if (HeightFragmentView.Num() > 0 && HeightParams)
+			{
+				HeightFragmentView[EntityIndex].TimeSinceRefresh = FMath::FRandRange(0.f, HeightParams->BaseRefreshPeriod);
+			}
+			if (CollisionDataFragmentView.Num() > 0 && CollisionParams)
+			{
+				CollisionDataFragmentView[EntityIndex].TimeSinceLastCheck = FMath::FRandRange(0.f, CollisionParams->CheckDelay);
+			}
+		}
+	});
+}
+
+UStaggerEnemyCheckProcessor::UStaggerEnemyCheckProcessor()
+	:EntityQuery(*this)
+{
+	ObservedType = FNearEnemiesFragment::StaticStruct();
+#if ENGINE_MAJOR_VERSION==5 && ENGINE_MINOR_VERSION<7 
+	Operation = EMassObservedOperation::Add;
+#else
+	ObservedOperations = EMassObservedOperationFlags::Add;
+#endif
+}
+
+void UStaggerEnemyCheckProcessor::ConfigureQueries(const TSharedRef<FMassEntityManager>& EntityManager)
+{
+	EntityQuery.AddRequirement<FNearEnemiesFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddConstSharedRequirement<FNearEnemiesParams>();
+}
+
+void UStaggerEnemyCheckProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	EntityQuery.ForEachEntityChunk(Context, [](FMassExecutionContext& Context)
+	{
+		TArrayView<FNearEnemiesFragment> NearEnemiesFragmentView = Context.GetMutableFragmentView<FNearEnemiesFragment>();
+		const FNearEnemiesParams& NearEnemiesParams = Context.GetConstSharedFragment<FNearEnemiesParams>();
+
+		for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
+		{
+			NearEnemiesFragmentView[EntityIndex].TimeSinceLastCheck = FMath::FRandRange(0.f, NearEnemiesParams.CheckPeriod);
+		}
+	});
+}
+
 
 
 UHeightProcessor::UHeightProcessor()
@@ -582,68 +1214,84 @@ void UHeightProcessor::ConfigureQueries(const TSharedRef<FMassEntityManager>& En
 
 	EntityQuery.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadWrite);
 	EntityQuery.AddRequirement<FHeightFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddConstSharedRequirement<FHeightParams>();
 	EntityQuery.AddRequirement<FMassDesiredMovementFragment>(EMassFragmentAccess::ReadWrite);
 	EntityQuery.AddRequirement<FMassVelocityFragment>(EMassFragmentAccess::ReadWrite);
 	EntityQuery.AddRequirement<FAnimationFragment>(EMassFragmentAccess::ReadWrite);
+	AddVariableTickRequirements(EntityQuery);
 }
 
 void UHeightProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
 {
 	float DeltaTime = FMath::Min(Context.GetDeltaTimeSeconds(),0.21f);
+	USmbSubsystem* SmbSubsystem = GetWorld()->GetSubsystem<USmbSubsystem>();
+	if (!SmbSubsystem) return;
 	
-	
-	EntityQuery.ParallelForEachEntityChunk(Context, [DeltaTime](FMassExecutionContext& Context)
+	EntityQuery.ParallelForEachEntityChunk(Context, [DeltaTime, SmbSubsystem](FMassExecutionContext& Context)
 	{
-		UNavigationSystemV1* NavMeshSubsystem = Cast<UNavigationSystemV1>(Context.GetWorld()->GetNavigationSystem());
 		TArrayView<FTransformFragment> TransformFragmentView = Context.GetMutableFragmentView<FTransformFragment>();
 		TArrayView<FHeightFragment> HeightFragmentView = Context.GetMutableFragmentView<FHeightFragment>();
+		const FHeightParams& HeightParams = Context.GetConstSharedFragment<FHeightParams>();
 		TArrayView <FMassDesiredMovementFragment> DesiredMovementFragmentView = Context.GetMutableFragmentView<FMassDesiredMovementFragment>();
 		TArrayView<FAnimationFragment> AnimationFragmentView = Context.GetMutableFragmentView<FAnimationFragment>();
+		TConstArrayView<FMassSimulationVariableTickFragment> VariableTickView = Context.GetFragmentView<FMassSimulationVariableTickFragment>();
+		TArray<FSmbNavProjection> Projections;
+		TArray<FVector> HeightSamples;
+		const FSmbHeightCache& HeightCache = SmbSubsystem->GetHeightCache();
+		const bool bUseHeightCache = SmbSubsystem->IsHeightCacheEnabled();
 		
 		for (FMassExecutionContext::FEntityIterator EntityIt = Context.CreateEntityIterator(); EntityIt; ++EntityIt)
 		{
-			if (!NavMeshSubsystem) continue;
 			FTransformFragment& TransformFragment = TransformFragmentView[EntityIt];
 			FTransform& Transform = TransformFragment.GetMutableTransform();
 			FHeightFragment& HeightFragment = HeightFragmentView[EntityIt];
 			FAnimationFragment& AnimationFragment = AnimationFragmentView[EntityIt];
 			FMassDesiredMovementFragment& DesiredMovementFragment = DesiredMovementFragmentView[EntityIt];
+			const float EntityDeltaTime = FMath::Min(GetEntityDeltaTime(VariableTickView, EntityIt, DeltaTime), 0.21f);
 			
 			if (AnimationFragment.CurrentState == EAnimationState::Attacking)
 			{
 				DesiredMovementFragment.DesiredVelocity = DesiredMovementFragment.DesiredVelocity*0.95f;
 			}
-			HeightFragment.TimeSinceRefresh += DeltaTime;
+			HeightFragment.TimeSinceRefresh += EntityDeltaTime;
 			if (HeightFragment.CurrentHeight <= -999999999.f)
 			{
 				HeightFragment.CurrentHeight = Transform.GetLocation().Z;
 			}
-			if (HeightFragment.TimeSinceRefresh > HeightFragment.BaseRefreshPeriod)
+			if (HeightFragment.TimeSinceRefresh > HeightParams.BaseRefreshPeriod)
 			{
-				FNavLocation NavLocation;
-				bool bFoundLocation = NavMeshSubsystem->ProjectPointToNavigation(Transform.GetLocation()+DesiredMovementFragment.DesiredVelocity*HeightFragment.BaseRefreshPeriod,NavLocation, FVector(100.f,100.f,700.f));
-				//UE_LOG(LogTemp, Display, TEXT("Links total: %i "),NavMeshSubsystem->GetNav);
-				if (bFoundLocation)
-				{
-					HeightFragment.TargetHeight = NavLocation.Location.Z;
-					//HeightFragment.CurrentHeight = Transform.GetLocation().Z;
-					//TransformFragmentView[EntityIt].GetMutableTransform().SetLocation(FVector(NavLocation.Location.X,NavLocation.Location.Y,NavLocation.Location.Z));
-				} else
+				HeightFragment.TimeSinceRefresh = 0.f;
+				const FVector AheadLocation = Transform.GetLocation()+DesiredMovementFragment.DesiredVelocity*HeightParams.BaseRefreshPeriod;
+				ESmbHeightSample CacheResult = ESmbHeightSample::NoNav;
+				if (bUseHeightCache)
 				{
-					bFoundLocation = NavMeshSubsystem->ProjectPointToNavigation(Transform.GetLocation()+DesiredMovementFragment.DesiredVelocity*HeightFragment.BaseRefreshPeriod,NavLocation, FVector(200.f,200.f,700.f)*HeightFragment.DistanceAwayToCheckNavMulti);
-					if (bFoundLocation)
+					float CachedHeight;
+					CacheResult = HeightCache.Sample(AheadLocation, 700.f, CachedHeight);
+					if (CacheResult == ESmbHeightSample::Hit)
 					{
-						Transform.SetLocation(NavLocation.Location);
-						HeightFragment.TargetHeight = NavLocation.Location.Z;
+						HeightFragment.TargetHeight = CachedHeight;
+					}
+					else if (CacheResult == ESmbHeightSample::Miss)
+					{
+						HeightCache.RequestMissing(AheadLocation, HeightSamples);
 					}
 				}
-				HeightFragment.TimeSinceRefresh = 0.f;
+				if (CacheResult != ESmbHeightSample::Hit)
+				{
+					// The navmesh is read at the end of the frame, the subsystem writes the result into the fragment then
+					FSmbNavProjection& Projection = Projections.AddDefaulted_GetRef();
+					Projection.Owner = Context.GetEntity(EntityIt);
+					Projection.Purpose = ESmbNavProjectionPurpose::Height;
+					Projection.Point = AheadLocation;
+					Projection.Extent = FVector(100.f,100.f,700.f);
+					Projection.FallbackExtent = FVector(200.f,200.f,700.f)*HeightParams.DistanceAwayToCheckNavMulti;
+				}
 			}
 
 			float DistanceZRemaining = HeightFragment.TargetHeight-HeightFragment.CurrentHeight;
 
-			float ZVelocity = FMath::Clamp(DistanceZRemaining,-1.f,1.f)*HeightFragment.HeightInterpolationSpeed*DeltaTime;
-			if (FMath::Abs(HeightFragment.HeightInterpolationSpeed/100.f) >= FMath::Abs(DistanceZRemaining))
+			float ZVelocity = FMath::Clamp(DistanceZRemaining,-1.f,1.f)*HeightParams.HeightInterpolationSpeed*EntityDeltaTime;
+			if (FMath::Abs(HeightParams.HeightInterpolationSpeed/100.f) >= FMath::Abs(DistanceZRemaining))
 			{
 				Transform.SetLocation(FVector(Transform.GetLocation().X,Transform.GetLocation().Y,HeightFragment.CurrentHeight));
 			} else
@@ -653,6 +1301,8 @@ void UHeightProcessor::Execute(FMassEntityManager& EntityManager, FMassExecution
 			
 			HeightFragment.CurrentHeight = Transform.GetLocation().Z;
 		}
+		SmbSubsystem->QueueNavProjections(Projections);
+		SmbSubsystem->QueueHeightSamples(HeightSamples);
 	});
 }
 
@@ -883,7 +1533,7 @@ void UClientMoveProcessor::ConfigureQueries(const TSharedRef<FMassEntityManager>
 	//FMassEntityQuery EntityQuery(EntityManager);
 
 	EntityQuery.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadWrite);
-	EntityQuery.AddRequirement<FLocationDataFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddRequirement<FLocationTargetFragment>(EMassFragmentAccess::ReadWrite);
 	EntityQuery.AddRequirement<FMassDesiredMovementFragment>(EMassFragmentAccess::ReadWrite);
 	EntityQuery.AddConstSharedRequirement<FMassMovementParameters>();
 }
@@ -895,32 +1545,90 @@ void UClientMoveProcessor::Execute(FMassEntityManager& EntityManager, FMassExecu
 	EntityQuery.ForEachEntityChunk(Context, [DeltaTime](FMassExecutionContext& Context)
 	{
 		TArrayView<FTransformFragment> TransformFragmentView = Context.GetMutableFragmentView<FTransformFragment>();
-		TArrayView<FLocationDataFragment> LocationDataFragmentView = Context.GetMutableFragmentView<FLocationDataFragment>();
+		TArrayView<FLocationTargetFragment> LocationTargetFragmentView = Context.GetMutableFragmentView<FLocationTargetFragment>();
 		TArrayView<FMassDesiredMovementFragment> DesiredMovementFragmentsView = Context.GetMutableFragmentView<FMassDesiredMovementFragment>();
 		FMassMovementParameters MovementParameters = Context.GetConstSharedFragment<FMassMovementParameters>();
 		for (FMassExecutionContext::FEntityIterator EntityIt = Context.CreateEntityIterator(); EntityIt; ++EntityIt)
 		{
 			FTransformFragment& TransformFragment = TransformFragmentView[EntityIt];
-			FLocationDataFragment& LocationDataFragment = LocationDataFragmentView[EntityIt];
+			FLocationTargetFragment& LocationTargetFragment = LocationTargetFragmentView[EntityIt];
 			FMassDesiredMovementFragment& DesiredMovementFragment = DesiredMovementFragmentsView[EntityIt];
 
-			if (LocationDataFragment.bIsFirstMove) 
+			if (LocationTargetFragment.bIsFirstMove) 
 			{
-				TransformFragment.GetMutableTransform().SetLocation(LocationDataFragment.NextLocation);
-				LocationDataFragment.bIsFirstMove = false;
+				TransformFragment.GetMutableTransform().SetLocation(LocationTargetFragment.NextLocation);
+				LocationTargetFragment.bIsFirstMove = false;
 			}
 			
-			if (LocationDataFragment.NextLocation != FVector::ZeroVector)
+			if (LocationTargetFragment.NextLocation != FVector::ZeroVector)
 			{
 				//UE_LOG(LogTemp, Display, TEXT("New Location"));
 				FTransform MutableTransform = TransformFragment.GetMutableTransform();
-				FVector DesiredDirection = (LocationDataFragment.NextLocation-MutableTransform.GetLocation()).GetSafeNormal();
+				FVector DesiredDirection = (LocationTargetFragment.NextLocation-MutableTransform.GetLocation()).GetSafeNormal();
 				DesiredMovementFragment.DesiredVelocity = MovementParameters.DefaultDesiredSpeed*DesiredDirection;
 			}
 		}
 	});
 }
 
+UFlowFieldProcessor::UFlowFieldProcessor()
+	:EntityQuery(*this)
+{
+	bAutoRegisterWithProcessingPhases = true;
+	ExecutionFlags = (int32)(EProcessorExecutionFlags::Standalone | EProcessorExecutionFlags::Server);
+	ExecutionOrder.ExecuteAfter.Add(UE::Mass::ProcessorGroupNames::Tasks);
+	ExecutionOrder.ExecuteBefore.Add(UE::Mass::ProcessorGroupNames::Avoidance);
+}
+
+void UFlowFieldProcessor::ConfigureQueries(const TSharedRef<FMassEntityManager>& EntityManager)
+{
+	EntityQuery.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddRequirement<FSmbFlowFollowerFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddRequirement<FMassMoveTargetFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddRequirement<FMassDesiredMovementFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddTagRequirement<FSmbSleepingTag>(EMassFragmentPresence::None);
+	EntityQuery.AddSubsystemRequirement<USmbSubsystem>(EMassFragmentAccess::ReadOnly);
+}
+
+void UFlowFieldProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	const USmbSubsystem* SmbSubsystem = GetWorld()->GetSubsystem<USmbSubsystem>();
+	if (!SmbSubsystem) return;
+	const float ToleranceSquared = FMath::Square(DestinationTolerance);
+
+	EntityQuery.ParallelForEachEntityChunk(Context, [SmbSubsystem, ToleranceSquared](FMassExecutionContext& Context)
+	{
+		TConstArrayView<FTransformFragment> TransformView = Context.GetFragmentView<FTransformFragment>();
+		TArrayView<FSmbFlowFollowerFragment> FollowerView = Context.GetMutableFragmentView<FSmbFlowFollowerFragment>();
+		TConstArrayView<FMassMoveTargetFragment> MoveTargetView = Context.GetFragmentView<FMassMoveTargetFragment>();
+		TArrayView<FMassDesiredMovementFragment> DesiredMovementView = Context.GetMutableFragmentView<FMassDesiredMovementFragment>();
+
+		for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
+		{
+			FSmbFlowFollowerFragment& Follower = FollowerView[EntityIndex];
+			if (Follower.FlowFieldId == INDEX_NONE) continue;
+			const FSmbFlowField* Field = SmbSubsystem->FindReadyFlowField(Follower.FlowFieldId);
+			if (!Field)
+			{
+				// Still building keeps the id, steering drives straight until the field is there
+				if (!SmbSubsystem->HasFlowField(Follower.FlowFieldId)) Follower.FlowFieldId = INDEX_NONE;
+				continue;
+			}
+
+			// Attacking or any other walk target leaves the field alone, the order picks up again when the target returns to it
+			const FMassMoveTargetFragment& MoveTarget = MoveTargetView[EntityIndex];
+			if (MoveTarget.GetCurrentAction() != EMassMovementAction::Move) continue;
+			if (FVector2D::DistSquared(FVector2D(MoveTarget.Center), FVector2D(Follower.Destination)) > ToleranceSquared) continue;
+
+			FVector2D Direction;
+			if (!Field->SampleDirection(TransformView[EntityIndex].GetTransform().GetLocation(), Direction)) continue;
+			FVector& DesiredVelocity = DesiredMovementView[EntityIndex].DesiredVelocity;
+			const float Speed = DesiredVelocity.Size2D();
+			DesiredVelocity = FVector(Direction*Speed, DesiredVelocity.Z);
+		}
+	});
+}
+
 
 
 /*
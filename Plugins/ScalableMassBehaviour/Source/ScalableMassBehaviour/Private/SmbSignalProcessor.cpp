@@ -17,6 +17,8 @@ void USmbSignalProcessor::InitializeInternal(UObject& Owner, const TSharedRef<FM
 
 	SubscribeToSignal(*SignalSubsystem, Smb::Signals::AttackFinished);
 	SubscribeToSignal(*SignalSubsystem, Smb::Signals::FoundEnemy);
+	SubscribeToSignal(*SignalSubsystem, Smb::Signals::ClosestEnemyChanged);
+	SubscribeToSignal(*SignalSubsystem, Smb::Signals::EnemiesLost);
 	SubscribeToSignal(*SignalSubsystem, Smb::Signals::ReceivedDamage);
 	SubscribeToSignal(*SignalSubsystem, Smb::Signals::MoveTargetChanged);
 
@@ -0,0 +1,485 @@
+﻿// Copyright © 2025 Land Chaunax, All rights reserved.
+
+
+#include "SmbSpatialGrid.h"
+
+
+uint32 FSmbSpatialGrid::HashKey(uint64 Key)
+{
+	//Murmur3 finalizer, neighbouring cells should not end up in neighbouring table slots
+	Key ^= Key >> 33;
+	Key *= 0xff51afd7ed558ccdull;
+	Key ^= Key >> 33;
+	Key *= 0xc4ceb9fe1a85ec53ull;
+	Key ^= Key >> 33;
+	return static_cast<uint32>(Key);
+}
+
+int32 FSmbSpatialGrid::FindCellInTable(TConstArrayView<FTableSlot> Table, int32 X, int32 Y)
+{
+	if (Table.Num() == 0) return INDEX_NONE;
+	const uint64 Key = PackCoord(X, Y);
+	const int32 Mask = Table.Num()-1;
+	int32 TableIndex = HashKey(Key) & Mask;
+	while (true)
+	{
+		const FTableSlot& TableSlot = Table[TableIndex];
+		if (TableSlot.CellIndex == INDEX_NONE) return INDEX_NONE;
+		if (TableSlot.Key == Key) return TableSlot.CellIndex;
+		TableIndex = (TableIndex+1) & Mask;
+	}
+}
+
+int32 FSmbSpatialGrid::FindCell(int32 X, int32 Y) const
+{
+	return FindCellInTable(Table, X, Y);
+}
+
+int32 FSmbSpatialGrid::FindOrAddCell(int32 X, int32 Y)
+{
+	//Keep the load factor under a half so probe chains stay short
+	if ((Cells.Num()+1)*2 > Table.Num()) GrowTable();
+
+	const uint64 Key = PackCoord(X, Y);
+	const int32 Mask = Table.Num()-1;
+	int32 TableIndex = HashKey(Key) & Mask;
+	while (true)
+	{
+		FTableSlot& TableSlot = Table[TableIndex];
+		if (TableSlot.CellIndex == INDEX_NONE)
+		{
+			TableSlot.Key = Key;
+			TableSlot.CellIndex = Cells.AddDefaulted();
+			Cells[TableSlot.CellIndex].Coord = FIntPoint(X, Y);
+			return TableSlot.CellIndex;
+		}
+		if (TableSlot.Key == Key) return TableSlot.CellIndex;
+		TableIndex = (TableIndex+1) & Mask;
+	}
+}
+
+void FSmbSpatialGrid::GrowTable()
+{
+	const int32 NewSize = FMath::Max(64, Table.Num()*2);
+	Table.Reset();
+	Table.SetNum(NewSize);
+	for (int32 CellIndex = 0; CellIndex < Cells.Num(); ++CellIndex)
+	{
+		InsertIntoTable(Table, Cells[CellIndex].Coord.X, Cells[CellIndex].Coord.Y, CellIndex);
+	}
+}
+
+void FSmbSpatialGrid::InsertIntoTable(TArray<FTableSlot>& Table, int32 X, int32 Y, int32 CellIndex)
+{
+	const uint64 Key = PackCoord(X, Y);
+	const int32 Mask = Table.Num()-1;
+	int32 TableIndex = HashKey(Key) & Mask;
+	while (Table[TableIndex].CellIndex != INDEX_NONE)
+	{
+		TableIndex = (TableIndex+1) & Mask;
+	}
+	Table[TableIndex].Key = Key;
+	Table[TableIndex].CellIndex = CellIndex;
+}
+
+FSmbGridCellView FSmbSpatialGrid::MakeCellView(const FCell& Cell)
+{
+	FSmbGridCellView View;
+	View.Handles = Cell.Handles;
+	View.X = Cell.X;
+	View.Y = Cell.Y;
+	View.Z = Cell.Z;
+	View.Radius = Cell.Radius;
+	View.Team = Cell.Team;
+	View.Flags = Cell.Flags;
+	return View;
+}
+
+void FSmbSpatialGrid::WriteSlot(FCell& Cell, int32 Slot, const FSmbGridEntityData& Data)
+{
+	Cell.X[Slot] = Data.Location.X;
+	Cell.Y[Slot] = Data.Location.Y;
+	Cell.Z[Slot] = Data.Location.Z;
+	Cell.Radius[Slot] = Data.Radius;
+	Cell.Team[Slot] = Data.Team;
+	Cell.Flags[Slot] = (Data.bAlive ? Alive : 0) | (Data.bDamageable ? Damageable : 0);
+}
+
+void FSmbSpatialGrid::RemoveEntry(FEntry& Entry)
+{
+	FCell& Cell = Cells[Entry.CellIndex];
+	const int32 LastSlot = Cell.Handles.Num()-1;
+	if (Entry.Slot != LastSlot)
+	{
+		//Fill the hole with the last entity of the cell and point its entry at the new slot
+		const FMassEntityHandle Moved = Cell.Handles[LastSlot];
+		Cell.Handles[Entry.Slot] = Moved;
+		Cell.X[Entry.Slot] = Cell.X[LastSlot];
+		Cell.Y[Entry.Slot] = Cell.Y[LastSlot];
+		Cell.Z[Entry.Slot] = Cell.Z[LastSlot];
+		Cell.Radius[Entry.Slot] = Cell.Radius[LastSlot];
+		Cell.Team[Entry.Slot] = Cell.Team[LastSlot];
+		Cell.Flags[Entry.Slot] = Cell.Flags[LastSlot];
+		Entries[Moved.Index].Slot = Entry.Slot;
+	}
+	Cell.Handles.Pop(EAllowShrinking::No);
+	Cell.X.Pop(EAllowShrinking::No);
+	Cell.Y.Pop(EAllowShrinking::No);
+	Cell.Z.Pop(EAllowShrinking::No);
+	Cell.Radius.Pop(EAllowShrinking::No);
+	Cell.Team.Pop(EAllowShrinking::No);
+	Cell.Flags.Pop(EAllowShrinking::No);
+	Entry.CellIndex = INDEX_NONE;
+	Entry.Slot = INDEX_NONE;
+	NumRegistered -= 1;
+}
+
+void FSmbSpatialGrid::AddToGrid(int32 X, int32 Y, FMassEntityHandle Handle, const FSmbGridEntityData& Data)
+{
+	if (!Handle.IsSet()) return;
+	if (Handle.Index >= Entries.Num()) Entries.AddDefaulted(Handle.Index+1-Entries.Num());
+
+	if (Entries[Handle.Index].CellIndex != INDEX_NONE)
+	{
+		FEntry& Existing = Entries[Handle.Index];
+		if (Existing.SerialNumber == Handle.SerialNumber && Cells[Existing.CellIndex].Coord == FIntPoint(X, Y))
+		{
+			//Same cell, only the data needs refreshing
+			WriteSlot(Cells[Existing.CellIndex], Existing.Slot, Data);
+			return;
+		}
+		//Either moved to another cell or the index got recycled by a new entity, both mean the old slot goes
+		RemoveEntry(Existing);
+	}
+
+	const int32 CellIndex = FindOrAddCell(X, Y);
+	FCell& Cell = Cells[CellIndex];
+	FEntry& Entry = Entries[Handle.Index];
+	Entry.SerialNumber = Handle.SerialNumber;
+	Entry.CellIndex = CellIndex;
+	Entry.Slot = Cell.Handles.Add(Handle);
+	Cell.X.AddUninitialized();
+	Cell.Y.AddUninitialized();
+	Cell.Z.AddUninitialized();
+	Cell.Radius.AddUninitialized();
+	Cell.Team.AddUninitialized();
+	Cell.Flags.AddUninitialized();
+	WriteSlot(Cell, Entry.Slot, Data);
+	NumRegistered += 1;
+}
+
+bool FSmbSpatialGrid::TryUpdateInPlace(int32 X, int32 Y, FMassEntityHandle Handle, const FSmbGridEntityData& Data)
+{
+	if (!Entries.IsValidIndex(Handle.Index)) return false;
+	const FEntry& Entry = Entries[Handle.Index];
+	if (Entry.CellIndex == INDEX_NONE || Entry.SerialNumber != Handle.SerialNumber) return false;
+	FCell& Cell = Cells[Entry.CellIndex];
+	if (Cell.Coord != FIntPoint(X, Y)) return false;
+	WriteSlot(Cell, Entry.Slot, Data);
+	return true;
+}
+
+void FSmbSpatialGrid::RemoveFromGrid(FMassEntityHandle Handle)
+{
+	if (!Entries.IsValidIndex(Handle.Index)) return;
+	FEntry& Entry = Entries[Handle.Index];
+	if (Entry.CellIndex == INDEX_NONE || Entry.SerialNumber != Handle.SerialNumber) return;
+	RemoveEntry(Entry);
+}
+
+bool FSmbSpatialGrid::Contains(FMassEntityHandle Handle) const
+{
+	if (!Entries.IsValidIndex(Handle.Index)) return false;
+	const FEntry& Entry = Entries[Handle.Index];
+	return Entry.CellIndex != INDEX_NONE && Entry.SerialNumber == Handle.SerialNumber;
+}
+
+TConstArrayView<FMassEntityHandle> FSmbSpatialGrid::GetAt(int32 X, int32 Y) const
+{
+	const int32 CellIndex = FindCell(X, Y);
+	if (CellIndex == INDEX_NONE) return TConstArrayView<FMassEntityHandle>();
+	return Cells[CellIndex].Handles;
+}
+
+TArray<FMassEntityHandle> FSmbSpatialGrid::GetAround(int32 X, int32 Y, int32 Radius) const
+{
+	TArray<FMassEntityHandle> Handles = TArray<FMassEntityHandle>();
+	for (int i = -Radius; i <= Radius; ++i)
+	{
+		for (int j = -Radius; j <= Radius; ++j)
+		{
+			Handles.Append(GetAt(X+i,Y+j));
+		}
+	}
+
+	return Handles;
+}
+
+void FSmbSpatialGrid::EmptySelf()
+{
+	Cells.Empty();
+	Entries.Empty();
+	Table.Empty();
+	NumRegistered = 0;
+}
+
+void FSmbGridSnapshot::Build(const FSmbSpatialGrid& Grid, int32 InCoarseFactor)
+{
+	Table = Grid.Table;
+	CoarseFactor = FMath::Max(1, InCoarseFactor);
+
+	const int32 NumCells = Grid.Cells.Num();
+	CellCoords.SetNumUninitialized(NumCells, EAllowShrinking::No);
+	CellStart.SetNumUninitialized(NumCells+1, EAllowShrinking::No);
+	int32 Total = 0;
+	for (int32 CellIndex = 0; CellIndex < NumCells; ++CellIndex)
+	{
+		CellCoords[CellIndex] = Grid.Cells[CellIndex].Coord;
+		CellStart[CellIndex] = Total;
+		Total += Grid.Cells[CellIndex].Handles.Num();
+	}
+	CellStart[NumCells] = Total;
+
+	Handles.SetNumUninitialized(Total, EAllowShrinking::No);
+	X.SetNumUninitialized(Total, EAllowShrinking::No);
+	Y.SetNumUninitialized(Total, EAllowShrinking::No);
+	Z.SetNumUninitialized(Total, EAllowShrinking::No);
+	Radius.SetNumUninitialized(Total, EAllowShrinking::No);
+	Team.SetNumUninitialized(Total, EAllowShrinking::No);
+	Flags.SetNumUninitialized(Total, EAllowShrinking::No);
+	CellRunStart.SetNumUninitialized(NumCells+1, EAllowShrinking::No);
+	TeamRuns.Reset();
+	EntityToFlat.SetNumUninitialized(Grid.Entries.Num(), EAllowShrinking::No);
+	for (int32& FlatIndex : EntityToFlat)
+	{
+		FlatIndex = INDEX_NONE;
+	}
+	MaxRadius = 0.f;
+	for (int32 CellIndex = 0; CellIndex < NumCells; ++CellIndex)
+	{
+		const FSmbSpatialGrid::FCell& Cell = Grid.Cells[CellIndex];
+		const int32 Start = CellStart[CellIndex];
+		CellRunStart[CellIndex] = TeamRuns.Num();
+
+		// Stable so entities of one team keep their grid order and the snapshot stays deterministic
+		SlotOrder.Reset();
+		for (int32 Slot = 0; Slot < Cell.Handles.Num(); ++Slot)
+		{
+			SlotOrder.Add(Slot);
+		}
+		SlotOrder.StableSort([&Cell](int32 A, int32 B)
+		{
+			return Cell.Team[A] < Cell.Team[B];
+		});
+
+		for (int32 i = 0; i < SlotOrder.Num(); ++i)
+		{
+			const int32 Slot = SlotOrder[i];
+			const int32 FlatIndex = Start+i;
+			Handles[FlatIndex] = Cell.Handles[Slot];
+			X[FlatIndex] = Cell.X[Slot];
+			Y[FlatIndex] = Cell.Y[Slot];
+			Z[FlatIndex] = Cell.Z[Slot];
+			Radius[FlatIndex] = Cell.Radius[Slot];
+			Team[FlatIndex] = Cell.Team[Slot];
+			Flags[FlatIndex] = Cell.Flags[Slot];
+			EntityToFlat[Cell.Handles[Slot].Index] = FlatIndex;
+			MaxRadius = FMath::Max(MaxRadius, Cell.Radius[Slot]);
+
+			if (i == 0 || TeamRuns.Last().Team != Cell.Team[Slot])
+			{
+				FSmbGridTeamRun& Run = TeamRuns.AddDefaulted_GetRef();
+				Run.Team = Cell.Team[Slot];
+				Run.Start = i;
+			}
+			TeamRuns.Last().Num += 1;
+		}
+	}
+	CellRunStart[NumCells] = TeamRuns.Num();
+
+	BuildCoarseLevel();
+}
+
+void FSmbGridSnapshot::BuildCoarseLevel()
+{
+	const int32 NumCells = CellCoords.Num();
+
+	// Never more coarse cells than fine ones, so the table is sized once and never grows
+	CoarseTable.Reset();
+	CoarseTable.SetNum(static_cast<int32>(FMath::RoundUpToPowerOfTwo(FMath::Max(64, NumCells*2))));
+	FineToCoarse.SetNumUninitialized(NumCells, EAllowShrinking::No);
+	int32 NumCoarse = 0;
+	for (int32 CellIndex = 0; CellIndex < NumCells; ++CellIndex)
+	{
+		FineToCoarse[CellIndex] = INDEX_NONE;
+		if (CellStart[CellIndex] == CellStart[CellIndex+1]) continue;
+		const int32 CoarseX = FloorDiv(CellCoords[CellIndex].X, CoarseFactor);
+		const int32 CoarseY = FloorDiv(CellCoords[CellIndex].Y, CoarseFactor);
+		int32 CoarseIndex = FSmbSpatialGrid::FindCellInTable(CoarseTable, CoarseX, CoarseY);
+		if (CoarseIndex == INDEX_NONE)
+		{
+			CoarseIndex = NumCoarse++;
+			FSmbSpatialGrid::InsertIntoTable(CoarseTable, CoarseX, CoarseY, CoarseIndex);
+		}
+		FineToCoarse[CellIndex] = CoarseIndex;
+	}
+
+	// Counting sort of the fine cells by coarse cell
+	CoarseFineStart.Reset();
+	CoarseFineStart.SetNumZeroed(NumCoarse+1);
+	for (int32 CellIndex = 0; CellIndex < NumCells; ++CellIndex)
+	{
+		if (FineToCoarse[CellIndex] == INDEX_NONE) continue;
+		CoarseFineStart[FineToCoarse[CellIndex]+1] += 1;
+	}
+	for (int32 CoarseIndex = 0; CoarseIndex < NumCoarse; ++CoarseIndex)
+	{
+		CoarseFineStart[CoarseIndex+1] += CoarseFineStart[CoarseIndex];
+	}
+	CoarseFineCells.SetNumUninitialized(CoarseFineStart[NumCoarse], EAllowShrinking::No);
+	CoarseCursor.SetNumUninitialized(NumCoarse, EAllowShrinking::No);
+	FMemory::Memcpy(CoarseCursor.GetData(), CoarseFineStart.GetData(), NumCoarse*sizeof(int32));
+	for (int32 CellIndex = 0; CellIndex < NumCells; ++CellIndex)
+	{
+		if (FineToCoarse[CellIndex] == INDEX_NONE) continue;
+		CoarseFineCells[CoarseCursor[FineToCoarse[CellIndex]]++] = CellIndex;
+	}
+
+	// Teams per coarse cell, battles have a handful of teams so a linear search beats a map
+	CoarseTeamStart.SetNumUninitialized(NumCoarse+1, EAllowShrinking::No);
+	CoarseTeams.Reset();
+	for (int32 CoarseIndex = 0; CoarseIndex < NumCoarse; ++CoarseIndex)
+	{
+		const int32 TeamStart = CoarseTeams.Num();
+		CoarseTeamStart[CoarseIndex] = TeamStart;
+		for (int32 i = CoarseFineStart[CoarseIndex]; i < CoarseFineStart[CoarseIndex+1]; ++i)
+		{
+			const int32 CellIndex = CoarseFineCells[i];
+			for (int32 FlatIndex = CellStart[CellIndex]; FlatIndex < CellStart[CellIndex+1]; ++FlatIndex)
+			{
+				int32 TeamIndex = TeamStart;
+				while (TeamIndex < CoarseTeams.Num() && CoarseTeams[TeamIndex].Team != Team[FlatIndex])
+				{
+					++TeamIndex;
+				}
+				if (TeamIndex == CoarseTeams.Num())
+				{
+					CoarseTeams.AddDefaulted_GetRef().Team = Team[FlatIndex];
+				}
+				FSmbGridTeamCount& TeamCount = CoarseTeams[TeamIndex];
+				TeamCount.Num += 1;
+				const uint8 TargetableFlags = FSmbSpatialGrid::Alive | FSmbSpatialGrid::Damageable;
+				if ((Flags[FlatIndex] & TargetableFlags) == TargetableFlags) TeamCount.NumTargetable += 1;
+			}
+		}
+	}
+	CoarseTeamStart[NumCoarse] = CoarseTeams.Num();
+}
+
+bool FSmbGridSnapshot::Contains(FMassEntityHandle Handle) const
+{
+	if (!EntityToFlat.IsValidIndex(Handle.Index)) return false;
+	const int32 FlatIndex = EntityToFlat[Handle.Index];
+	return FlatIndex != INDEX_NONE && Handles[FlatIndex] == Handle;
+}
+
+FSmbGridCoarseCellView FSmbGridSnapshot::MakeCoarseCellView(int32 CoarseIndex) const
+{
+	const int32 Start = CoarseTeamStart[CoarseIndex];
+	FSmbGridCoarseCellView View;
+	View.Teams = TConstArrayView<FSmbGridTeamCount>(CoarseTeams).Slice(Start, CoarseTeamStart[CoarseIndex+1]-Start);
+	return View;
+}
+
+FSmbGridCellView FSmbGridSnapshot::MakeCellView(int32 CellIndex) const
+{
+	const int32 Start = CellStart[CellIndex];
+	const int32 Count = CellStart[CellIndex+1]-Start;
+	FSmbGridCellView View;
+	View.Handles = TConstArrayView<FMassEntityHandle>(Handles).Slice(Start, Count);
+	View.X = TConstArrayView<float>(X).Slice(Start, Count);
+	View.Y = TConstArrayView<float>(Y).Slice(Start, Count);
+	View.Z = TConstArrayView<float>(Z).Slice(Start, Count);
+	View.Radius = TConstArrayView<float>(Radius).Slice(Start, Count);
+	View.Team = TConstArrayView<int32>(Team).Slice(Start, Count);
+	View.Flags = TConstArrayView<uint8>(Flags).Slice(Start, Count);
+	const int32 RunStart = CellRunStart[CellIndex];
+	View.TeamRuns = TConstArrayView<FSmbGridTeamRun>(TeamRuns).Slice(RunStart, CellRunStart[CellIndex+1]-RunStart);
+	return View;
+}
+
+void FSmbGridSnapshot::Empty()
+{
+	Table.Empty();
+	CellStart.Empty();
+	Handles.Empty();
+	X.Empty();
+	Y.Empty();
+	Z.Empty();
+	Radius.Empty();
+	Team.Empty();
+	Flags.Empty();
+	CellRunStart.Empty();
+	TeamRuns.Empty();
+	EntityToFlat.Empty();
+	MaxRadius = 0.f;
+	CellCoords.Empty();
+	CoarseTable.Empty();
+	CoarseFineStart.Empty();
+	CoarseFineCells.Empty();
+	CoarseTeamStart.Empty();
+	CoarseTeams.Empty();
+	FineToCoarse.Empty();
+	CoarseCursor.Empty();
+	SlotOrder.Empty();
+}
+
+void FSmbNeighborQueryBatch::Add(FMassEntityHandle Owner, const FVector& Location, float Radius, int32 MaxCount, int32 ExcludedTeam)
+{
+	if (!Owner.IsSet()) return;
+	if (Owner.Index >= QueryOfEntity.Num())
+	{
+		const int32 OldNum = QueryOfEntity.Num();
+		QueryOfEntity.SetNumUninitialized(Owner.Index+1);
+		for (int32 EntityIndex = OldNum; EntityIndex < QueryOfEntity.Num(); ++EntityIndex)
+		{
+			QueryOfEntity[EntityIndex] = INDEX_NONE;
+		}
+	}
+
+	QueryOfEntity[Owner.Index] = Queries.Num();
+	FSmbNeighborQuery& Query = Queries.AddDefaulted_GetRef();
+	Query.Owner = Owner;
+	Query.Location = Location;
+	Query.Radius = Radius;
+	Query.ExcludedTeam = ExcludedTeam;
+	Query.MaxCount = FMath::Max(MaxCount, 0);
+	Query.ResultStart = NumResults;
+	NumResults += Query.MaxCount;
+	Results.SetNumUninitialized(NumResults, EAllowShrinking::No);
+}
+
+const FSmbNeighborQuery* FSmbNeighborQueryBatch::Find(FMassEntityHandle Owner) const
+{
+	if (!QueryOfEntity.IsValidIndex(Owner.Index)) return nullptr;
+	const int32 QueryIndex = QueryOfEntity[Owner.Index];
+	if (QueryIndex == INDEX_NONE || Queries[QueryIndex].Owner != Owner) return nullptr;
+	return &Queries[QueryIndex];
+}
+
+TConstArrayView<FMassEntityHandle> FSmbNeighborQueryBatch::GetResults(const FSmbNeighborQuery& Query) const
+{
+	return TConstArrayView<FMassEntityHandle>(Results).Slice(Query.ResultStart, Query.NumFound);
+}
+
+void FSmbNeighborQueryBatch::Reset()
+{
+	// Only clear what was set so a few queries don't pay for the whole index range
+	for (const FSmbNeighborQuery& Query : Queries)
+	{
+		QueryOfEntity[Query.Owner.Index] = INDEX_NONE;
+	}
+	Queries.Reset();
+	Results.Reset();
+	NumResults = 0;
+}
@@ -7,6 +7,7 @@
 #include "MassCommonFragments.h"
 #include "MassEntitySubsystem.h"
 #include "MassNavigationTypes.h"
+#include "MassNavigationFragments.h"
 #include "MassSignalSubsystem.h"
 #include "SmbFragments.h"
 #include "SmbPhysicsManager.h"
@@ -28,6 +29,8 @@
 #include "SmbProjectileHandler.h"
 #include "AI/NavigationSystemBase.h"
 #include "Kismet/GameplayStatics.h"
+#include "Misc/ScopeLock.h"
+#include "Async/ParallelFor.h"
 #include "SmbNiagaraContainer.h"
 #include "NavigationSystem.h"
 #include "SmbAssetManager.h"
@@ -54,8 +57,6 @@ void USmbSubsystem::Initialize(FSubsystemCollectionBase& Collection)
 	UMassSignalSubsystem* SignalSubsystem = GetWorld()->GetSubsystem<UMassSignalSubsystem>();
 	//SignalSubsystem->GetSignalDelegateByName(UE::Mass::Signals::StandTaskFinished);
 	
-	Grid = NewObject<UGrid>();
-
 	RegisteredResources = TMap<EProcessable, FProcessableArr>();
 
 	AbilitySpawningDataArray = TArray<FAbilitySpawningData>();
@@ -154,9 +155,23 @@ void USmbSubsystem::Deinitialize()
 	EntityManagerPtr.Reset();
 
 	RegisteredResources.Empty();
-	Grid->EmptySelf();
-	Grid->MarkAsGarbage();
-	Grid = nullptr;
+	Grid.EmptySelf();
+	PendingGridMoves.Empty();
+	Influence.EmptySelf();
+	// Builds read the navmesh, it has to outlive them
+	CancelFlowFieldBuilds();
+	FlowFields.Empty();
+	NavProjections.Reset();
+	// Traces in flight read the world's physics scene
+	GroundTraces.Reset();
+	HeightCache.Reset();
+	if (UNavigationSystemV1* NavSys = InvalidationNavSys.Get())
+	{
+		NavSys->OnNavigationGenerationFinishedDelegate.RemoveDynamic(this, &USmbSubsystem::OnNavigationGenerationFinished);
+	}
+	InvalidationNavSys.Reset();
+	GridSnapshots[0].Empty();
+	GridSnapshots[1].Empty();
 	ReqMap.EmptyMap();
 	CarryingFree.Empty();
 	PhysicsManagers.Empty();
@@ -170,6 +185,22 @@ void USmbSubsystem::Tick(float DeltaTime)
 {
 	Super::Tick(DeltaTime);
 
+	// Everything the processors and tasks asked of the navmesh this frame, answered for the next one
+	NavProjections.Resolve(*GetWorld());
+	ApplyNavProjections();
+	BindNavigationInvalidation();
+	// Fields sampled while a rebuild swaps tiles in would mix old and new ones
+	if (UNavigationSystemV1* NavSys = InvalidationNavSys.Get(); NavSys && NavSys->IsNavigationBuildInProgress())
+	{
+		CancelFlowFieldBuilds();
+	}
+	AdvanceFlowFieldBuilds();
+	if (bUseHeightCache)
+	{
+		HeightCache.SetSampleSpacing(HeightCacheSpacing);
+		HeightCache.Resolve(*GetWorld(), MaxHeightSamplesPerFrame);
+	}
+
 	DestroyStalledEntity(DeltaTime);
 	
 	for (int i = 0; i < AbilitySpawningDataArray.Num(); ++i)
@@ -352,47 +383,208 @@ FVector USmbSubsystem::GetEntityDataLocation(FSmbEntityData EntityData)
 
 TArray<FMassEntityHandle> USmbSubsystem::GetNumberClosestEntities(FVector Location, float Radius, int32 Amount, int32 Team)
 {
-	FVector2D Cell = VectorToCell(Location);
-	int32 RadiusInCell = Radius/CellSize;
-	int32 InsideRadius = 1+RadiusInCell;
-	TArray<FMassEntityHandle> UnitArr = Grid->GetAround(Cell.X,Cell.Y,InsideRadius);
 	TArray<FMassEntityHandle> ClosestArr = TArray<FMassEntityHandle>();
+	if (Amount <= 0) return ClosestArr;
+	ClosestArr.SetNumUninitialized(Amount);
+	const int32 NumFound = CollectClosestEntities(Location, Radius, ClosestArr, Team);
+	ClosestArr.SetNum(NumFound);
+	return ClosestArr;
+}
 
-	TArray<TPair<float, FMassEntityHandle>> DistanceArr;
-	for (auto Unit : UnitArr)
+namespace
+{
+	struct FNearestCandidate
 	{
-		
-		if (!EntityManagerPtr->IsEntityValid(Unit)) continue;
+		float DistanceSquared = 0.f;
+		FMassEntityHandle Handle;
+	};
 
-		//If team is not included all teams will be checked
-		int32 OtherTeam = -2;
-		if (FTeamFragment* TeamFragment = EntityManagerPtr->GetFragmentDataPtr<FTeamFragment>(Unit))
+	/* Heap predicate that keeps the farthest candidate on top, it is the one replaced when a closer one shows up */
+	struct FFartherFirst
+	{
+		bool operator()(const FNearestCandidate& A, const FNearestCandidate& B) const
 		{
-			OtherTeam = TeamFragment->TeamID;
+			return A.DistanceSquared > B.DistanceSquared;
 		}
-		if (OtherTeam == Team) continue;
-		
-		FTransformFragment* TransformFragment = EntityManagerPtr->GetFragmentDataPtr<FTransformFragment>(Unit);
-		if (!TransformFragment) continue;
-		
-		float Distance = (Location - TransformFragment->GetTransform().GetLocation()).Size();
-		if (Distance <= Radius)
+	};
+
+	// Amounts asked for by the processors are small, the inline buffer keeps this off the heap
+	using FNearestHeap = TArray<FNearestCandidate, TInlineAllocator<16>>;
+
+	bool WouldBeKept(const FNearestHeap& Nearest, int32 MaxCount, float DistanceSquared)
+	{
+		return Nearest.Num() < MaxCount || DistanceSquared < Nearest.HeapTop().DistanceSquared;
+	}
+
+	void KeepNearest(FNearestHeap& Nearest, int32 MaxCount, float DistanceSquared, FMassEntityHandle Handle)
+	{
+		if (Nearest.Num() == MaxCount)
+		{
+			Nearest.HeapPopDiscard(FFartherFirst(), EAllowShrinking::No);
+		}
+		Nearest.HeapPush(FNearestCandidate{DistanceSquared, Handle}, FFartherFirst());
+	}
+
+	/* Writes the kept handles closest first, only sorted once at the end since the heap is all the search needs */
+	int32 WriteNearest(FNearestHeap& Nearest, TArrayView<FMassEntityHandle> OutClosest)
+	{
+		Nearest.Sort([](const FNearestCandidate& A, const FNearestCandidate& B)
 		{
-			DistanceArr.Add(TPair<float, FMassEntityHandle>(Distance, Unit));
+			return A.DistanceSquared < B.DistanceSquared;
+		});
+		for (int32 i = 0; i < Nearest.Num(); ++i)
+		{
+			OutClosest[i] = Nearest[i].Handle;
 		}
+		return Nearest.Num();
 	}
-    
-	DistanceArr.Sort([](const TPair<float, FMassEntityHandle>& A, const TPair<float, FMassEntityHandle>& B) {
-		return A.Key < B.Key;
+
+	/* Entity gathered once for every query of a cell */
+	struct FNeighborCandidate
+	{
+		FVector Location;
+		FMassEntityHandle Handle;
+	};
+
+	/* Per worker buffers of one resolve, they grow on the first cells and are reused for the rest of the batch */
+	struct FNeighborScratch
+	{
+		TArray<FNeighborCandidate> Candidates;
+		TArray<FSmbGridTeamRun> Runs;
+		FNearestHeap Nearest;
+	};
+}
+
+int32 USmbSubsystem::CollectClosestEntities(const FVector& Location, float Radius, TArrayView<FMassEntityHandle> OutClosest, int32 Team) const
+{
+	const int32 MaxCount = OutClosest.Num();
+	if (MaxCount <= 0) return 0;
+	const float RadiusSquared = FMath::Square(Radius);
+
+	FNearestHeap Nearest;
+
+	ForEachNearestFirst(Location, Radius, [Team](const FSmbGridCoarseCellView& CoarseCell)
+	{
+		return Team == -1 || CoarseCell.HasOtherTeamThan(Team);
+	}, [Team](int32 OtherTeam)
+	{
+		//If team is not included all teams will be checked
+		return OtherTeam != Team;
+	}, [&](double RingDistanceSquared)
+	{
+		return Nearest.Num() == MaxCount && RingDistanceSquared >= Nearest.HeapTop().DistanceSquared;
+	}, [&](const FSmbGridCellView& CellView, int32 Slot)
+	{
+		const float DistanceSquared = FVector::DistSquared(Location, CellView.GetLocation(Slot));
+		if (DistanceSquared > RadiusSquared) return;
+		if (!WouldBeKept(Nearest, MaxCount, DistanceSquared)) return;
+
+		//Only candidates that would make the list are checked against the entity manager
+		const FMassEntityHandle Unit = CellView.Handles[Slot];
+		if (!EntityManagerPtr->IsEntityValid(Unit)) return;
+		KeepNearest(Nearest, MaxCount, DistanceSquared, Unit);
 	});
-    
-	int32 ResultCount = FMath::Min(Amount, DistanceArr.Num());
-	for (int32 i = 0; i < ResultCount; i++)
+
+	return WriteNearest(Nearest, OutClosest);
+}
+
+void USmbSubsystem::ResolveNeighborQueries(FSmbNeighborQueryBatch& Batch) const
+{
+	const int32 NumQueries = Batch.Queries.Num();
+	if (NumQueries == 0) return;
+
+	// Group the queries by the cell they are asked from
+	Batch.CellOrder.SetNumUninitialized(NumQueries, EAllowShrinking::No);
+	for (int32 QueryIndex = 0; QueryIndex < NumQueries; ++QueryIndex)
 	{
-		ClosestArr.Add(DistanceArr[i].Value);
+		FSmbNeighborQuery& Query = Batch.Queries[QueryIndex];
+		const FVector2D Cell = VectorToCell(Query.Location);
+		Query.Cell = FIntPoint(Cell.X, Cell.Y);
+		Query.NumFound = 0;
+		Batch.CellOrder[QueryIndex] = QueryIndex;
 	}
-    
-	return ClosestArr;
+	const TArray<FSmbNeighborQuery>& Queries = Batch.Queries;
+	Batch.CellOrder.Sort([&Queries](int32 A, int32 B)
+	{
+		const FIntPoint& CellA = Queries[A].Cell;
+		const FIntPoint& CellB = Queries[B].Cell;
+		return CellA.X != CellB.X ? CellA.X < CellB.X : (CellA.Y != CellB.Y ? CellA.Y < CellB.Y : A < B);
+	});
+	Batch.GroupStart.Reset();
+	for (int32 i = 0; i < NumQueries; ++i)
+	{
+		if (i == 0 || Queries[Batch.CellOrder[i]].Cell != Queries[Batch.CellOrder[i-1]].Cell)
+		{
+			Batch.GroupStart.Add(i);
+		}
+	}
+	Batch.GroupStart.Add(NumQueries);
+
+	const FSmbGridSnapshot& Snapshot = GetGridSnapshot();
+	const int32 NumGroups = Batch.GroupStart.Num()-1;
+	TArray<FNeighborScratch, TInlineAllocator<8>> Scratches;
+	ParallelForWithTaskContext(Scratches, NumGroups, [this, &Batch, &Snapshot](FNeighborScratch& Scratch, int32 GroupIndex)
+	{
+		const int32 GroupBegin = Batch.GroupStart[GroupIndex];
+		const int32 GroupEnd = Batch.GroupStart[GroupIndex+1];
+		const FIntPoint Cell = Batch.Queries[Batch.CellOrder[GroupBegin]].Cell;
+		float MaxRadius = 0.f;
+		// A team every query of the cell excludes is never gathered, enemy searches drop their own side here
+		int32 SharedExcludedTeam = Batch.Queries[Batch.CellOrder[GroupBegin]].ExcludedTeam;
+		for (int32 i = GroupBegin; i < GroupEnd; ++i)
+		{
+			const FSmbNeighborQuery& Query = Batch.Queries[Batch.CellOrder[i]];
+			MaxRadius = FMath::Max(MaxRadius, Query.Radius);
+			if (Query.ExcludedTeam != SharedExcludedTeam) SharedExcludedTeam = INDEX_NONE;
+		}
+		const bool bSkipSharedTeam = SharedExcludedTeam != INDEX_NONE;
+
+		// Everything any query of the cell can reach, from anywhere inside the cell
+		const FVector2D CellCenter = (FVector2D(Cell.X, Cell.Y)+0.5)*CellSize;
+		const float Reach = MaxRadius+CellSize*UE_HALF_SQRT_2;
+		TArray<FNeighborCandidate>& Candidates = Scratch.Candidates;
+		TArray<FSmbGridTeamRun>& Runs = Scratch.Runs;
+		Candidates.Reset();
+		Runs.Reset();
+		Snapshot.ForEachCellInRadius(CellCenter, Reach, CellSize, [&Candidates, &Runs, bSkipSharedTeam, SharedExcludedTeam](const FSmbGridCellView& CellView)
+		{
+			for (const FSmbGridTeamRun& CellRun : CellView.TeamRuns)
+			{
+				if (bSkipSharedTeam && CellRun.Team == SharedExcludedTeam) continue;
+				FSmbGridTeamRun& Run = Runs.AddDefaulted_GetRef();
+				Run.Team = CellRun.Team;
+				Run.Start = Candidates.Num();
+				Run.Num = CellRun.Num;
+				for (int32 Slot = CellRun.Start; Slot < CellRun.Start+CellRun.Num; ++Slot)
+				{
+					Candidates.Add(FNeighborCandidate{CellView.GetLocation(Slot), CellView.Handles[Slot]});
+				}
+			}
+		});
+
+		FNearestHeap& Nearest = Scratch.Nearest;
+		for (int32 i = GroupBegin; i < GroupEnd; ++i)
+		{
+			FSmbNeighborQuery& Query = Batch.Queries[Batch.CellOrder[i]];
+			if (Query.MaxCount <= 0) continue;
+			const float RadiusSquared = FMath::Square(Query.Radius);
+			Nearest.Reset();
+			for (const FSmbGridTeamRun& Run : Runs)
+			{
+				if (Run.Team == Query.ExcludedTeam) continue;
+				for (int32 CandidateIndex = Run.Start; CandidateIndex < Run.Start+Run.Num; ++CandidateIndex)
+				{
+					const FNeighborCandidate& Candidate = Candidates[CandidateIndex];
+					const float DistanceSquared = FVector::DistSquared(Query.Location, Candidate.Location);
+					if (DistanceSquared > RadiusSquared) continue;
+					if (!WouldBeKept(Nearest, Query.MaxCount, DistanceSquared)) continue;
+					if (!EntityManagerPtr->IsEntityValid(Candidate.Handle)) continue;
+					KeepNearest(Nearest, Query.MaxCount, DistanceSquared, Candidate.Handle);
+				}
+			}
+			Query.NumFound = WriteNearest(Nearest, MakeArrayView(Batch.Results.GetData()+Query.ResultStart, Query.MaxCount));
+		}
+	});
 }
 
 bool USmbSubsystem::RegisterPhysicsManager(ASmbPhysicsManager* InScalePhysicsManager, FString MeshName)
@@ -450,34 +642,32 @@ void USmbSubsystem::NewDeath(FString MeshName, int32 TotalDeaths, TArray<FVector
 
 FSmbEntityData USmbSubsystem::GetClosestEnemy(FVector Location, int32 TeamId, float Radius)
 {
-	FVector2D Cell = VectorToCell(Location);
-	int32 RadiusInCell = Radius/CellSize;
-	int32 InsideRadius = 1+RadiusInCell;
-	TArray<FMassEntityHandle> UnitArr = Grid->GetAround(Cell.X,Cell.Y,InsideRadius);
-
-	float MinDist = MAX_FLT;
-	FSmbEntityData ClosestData = FSmbEntityData();
+	float MinDistSquared = FMath::Square(Radius);
+	FMassEntityHandle ClosestHandle;
 
-	//UE_LOG(LogTemp, Warning, TEXT("Checking %i units"), UnitArr.Num());
-
-	for (auto Unit : UnitArr)
+	ForEachNearestFirst(Location, Radius, [TeamId](const FSmbGridCoarseCellView& CoarseCell)
 	{
-		if (!EntityManagerPtr->IsEntityValid(Unit)) continue;
-		FTransformFragment* TransformFragment = EntityManagerPtr->GetFragmentDataPtr<FTransformFragment>(Unit);
-		if (!TransformFragment) continue;
-		FTeamFragment* TeamFragment = EntityManagerPtr->GetFragmentDataPtr<FTeamFragment>(Unit);
-		if (!TeamFragment) continue;
-		if (TeamFragment->TeamID == TeamId) continue;
-		FDefenceFragment* DefenceFrag = EntityManagerPtr->GetFragmentDataPtr<FDefenceFragment>(Unit);
-		if (!DefenceFrag) continue;
-		if (DefenceFrag->HP <= 0) continue;
-		float Dist = (Location-TransformFragment->GetTransform().GetLocation()).Size();
-		if (Dist >= MinDist) continue;
-		MinDist = Dist;
-		ClosestData.SerialNumber = Unit.SerialNumber;
-		ClosestData.Index = Unit.Index;
-	}
-	return ClosestData;
+		return CoarseCell.HasTargetableEnemyOf(TeamId);
+	}, [TeamId](int32 OtherTeam)
+	{
+		return OtherTeam != FSmbSpatialGrid::NoTeam && OtherTeam != TeamId;
+	}, [&](double RingDistanceSquared)
+	{
+		return RingDistanceSquared >= MinDistSquared;
+	}, [&](const FSmbGridCellView& CellView, int32 Slot)
+	{
+		if (!CellView.IsDamageable(Slot) || !CellView.IsAlive(Slot)) return;
+		const float DistSquared = FVector::DistSquared(Location, CellView.GetLocation(Slot));
+		if (DistSquared >= MinDistSquared) return;
+		MinDistSquared = DistSquared;
+		ClosestHandle = CellView.Handles[Slot];
+	});
+
+	//Grid data can be a frame old, the winner is checked against the real fragment
+	if (!EntityManagerPtr->IsEntityValid(ClosestHandle)) return FSmbEntityData();
+	const FDefenceFragment* DefenceFrag = EntityManagerPtr->GetFragmentDataPtr<FDefenceFragment>(ClosestHandle);
+	if (!DefenceFrag || DefenceFrag->HP <= 0) return FSmbEntityData();
+	return FSmbEntityData(ClosestHandle);
 }
 
 void USmbSubsystem::SetProjectileLocations(TArray<FVector> Positions)
@@ -506,17 +696,110 @@ bool USmbSubsystem::DealDamageToEnemy(FSmbEntityData TargetData, float DamageAmo
 	{
 		DefenceFragmentPtr->HP = 0;
 	}
+	Influence.SetStrength(EnemyHandle, DefenceFragmentPtr->HP);
+	WakeEntities(MakeArrayView(&EnemyHandle, 1));
+	return true;
+}
+
+void USmbSubsystem::WakeEntities(TConstArrayView<FMassEntityHandle> Handles)
+{
+	for (const FMassEntityHandle& Handle : Handles)
+	{
+		if (!EntityManagerPtr->IsEntityValid(Handle)) continue;
+		if (!FMassEntityView(*EntityManagerPtr, Handle).HasTag<FSmbSleepingTag>()) continue;
+		EntityManagerPtr->Defer().RemoveTag<FSmbSleepingTag>(Handle);
+	}
+}
+
+namespace
+{
+	/* Only what enemy searches could target weighs on the influence map */
+	float InfluenceStrengthOf(const FSmbGridEntityData& Data)
+	{
+		return Data.bDamageable && Data.bAlive ? Data.Health : 0.f;
+	}
+}
+
+void USmbSubsystem::RegisterToGrid(FMassEntityHandle Handle, const FSmbGridEntityData& Data)
+{
+	FVector2D NewCell = VectorToCell(FVector(Data.Location));
+	Grid.AddToGrid(NewCell.X,NewCell.Y,Handle,Data);
+	Influence.Set(Handle, LocationToInfluenceCell(FVector(Data.Location)), Data.Team, InfluenceStrengthOf(Data));
+}
+
+void USmbSubsystem::UpdateGridEntity(FMassEntityHandle Handle, const FSmbGridEntityData& Data, TArray<FSmbGridMove>& OutMoves)
+{
+	const FVector2D NewCell = VectorToCell(FVector(Data.Location));
+	// Damage already keeps the influence map current, an HP change from anywhere else goes through the serial flush like a cell change
+	if (Grid.TryUpdateInPlace(NewCell.X,NewCell.Y,Handle,Data)
+		&& Influence.GetStrength(Handle) == InfluenceStrengthOf(Data)) return;
+	FSmbGridMove& Move = OutMoves.AddDefaulted_GetRef();
+	Move.Handle = Handle;
+	Move.Cell = FIntPoint(NewCell.X,NewCell.Y);
+	Move.Data = Data;
+}
+
+void USmbSubsystem::QueueGridMoves(TArray<FSmbGridMove>& ChunkMoves)
+{
+	if (ChunkMoves.Num() == 0) return;
+	FScopeLock Lock(&PendingGridMovesLock);
+	PendingGridMoves.Append(ChunkMoves);
+	ChunkMoves.Reset();
+}
+
+void USmbSubsystem::FlushGridMoves()
+{
+	FScopeLock Lock(&PendingGridMovesLock);
+	PendingGridMoves.Sort([](const FSmbGridMove& A, const FSmbGridMove& B)
+	{
+		return A.Handle.Index < B.Handle.Index;
+	});
+	for (const FSmbGridMove& Move : PendingGridMoves)
+	{
+		Grid.AddToGrid(Move.Cell.X,Move.Cell.Y,Move.Handle,Move.Data);
+		Influence.Set(Move.Handle, LocationToInfluenceCell(FVector(Move.Data.Location)), Move.Data.Team, InfluenceStrengthOf(Move.Data));
+	}
+	PendingGridMoves.Reset();
+}
+
+FIntPoint USmbSubsystem::LocationToInfluenceCell(const FVector& Location) const
+{
+	const double InfluenceCellSize = static_cast<double>(CellSize)*InfluenceCellFactor;
+	return FIntPoint(FMath::FloorToInt32(Location.X/InfluenceCellSize), FMath::FloorToInt32(Location.Y/InfluenceCellSize));
+}
+
+bool USmbSubsystem::HasEnemyInfluence(const FVector& Location, float Radius, int32 Team) const
+{
+	const FIntPoint Cell = LocationToInfluenceCell(Location);
+	// Padded by the widest agent like the other radius searches, an enemy whose body reaches into Radius must not be pruned
+	const float Reach = Radius+GetGridSnapshot().GetMaxRadius();
+	const int32 CellRadius = FMath::CeilToInt32(Reach/(CellSize*InfluenceCellFactor));
+	return Influence.HasEnemyAround(Cell.X, Cell.Y, CellRadius, Team);
+}
+
+float USmbSubsystem::GetEnemyInfluence(FVector Location, int32 Team) const
+{
+	const FIntPoint Cell = LocationToInfluenceCell(Location);
+	return Influence.GetEnemyStrengthAt(Cell.X, Cell.Y, Team);
+}
+
+bool USmbSubsystem::GetStrongestThreatDirection(FVector Location, int32 Team, FVector& OutDirection, float& OutStrength) const
+{
+	OutDirection = FVector::ZeroVector;
+	const FIntPoint Cell = LocationToInfluenceCell(Location);
+	FIntPoint StrongestCell;
+	if (!Influence.FindStrongestEnemyCell(Cell.X, Cell.Y, 1, Team, StrongestCell, OutStrength)) return false;
+	const double InfluenceCellSize = static_cast<double>(CellSize)*InfluenceCellFactor;
+	const FVector CellCenter = FVector((StrongestCell.X+0.5)*InfluenceCellSize, (StrongestCell.Y+0.5)*InfluenceCellSize, Location.Z);
+	OutDirection = (CellCenter-Location).GetSafeNormal2D();
 	return true;
 }
 
-FVector USmbSubsystem::RegisterToGrid(FVector NewLocation, FMassEntityHandle Handle, FVector OldLocation)
+void USmbSubsystem::PublishGridSnapshot()
 {
-	if (!EntityManagerPtr->IsEntityValid(Handle)) return FVector::DownVector;
-	FVector2D NewCell = VectorToCell(NewLocation);
-	FVector2D OldCell = VectorToCell(OldLocation);
-	Grid->RemoveAt(OldCell.X,OldCell.Y,Handle);
-	Grid->AddToGrid(NewCell.X,NewCell.Y,Handle);
-	return NewLocation;
+	const int32 BackIndex = 1-ReadSnapshotIndex.load(std::memory_order_relaxed);
+	GridSnapshots[BackIndex].Build(Grid, CoarseCellFactor);
+	ReadSnapshotIndex.store(BackIndex, std::memory_order_release);
 }
 
 bool USmbSubsystem::AddPhysicsManagerToWorld(TSoftObjectPtr<UStaticMesh> StaticMesh)
@@ -558,43 +841,51 @@ bool USmbSubsystem::AddPhysicsManagerToWorld(TSoftObjectPtr<UStaticMesh> StaticM
 
 bool USmbSubsystem::DealDamageAoe(FVector InLocation, float Radius, float DamageAmount, EDamageType DamageType, int32 OwnTeam, int32 &AmountKilled)
 {
-	FVector2D CellLocation = VectorToCell(InLocation);
-	TArray<FMassEntityHandle> EnemyArray = Grid->GetAround(CellLocation.X,CellLocation.Y,Radius);
 	UMassSignalSubsystem* SignalSubsystem = GetWorld()->GetSubsystem<UMassSignalSubsystem>();
 	TArray<FMassEntityHandle> Signaled = TArray<FMassEntityHandle>();
+	const FSmbGridSnapshot& Snapshot = GetGridSnapshot();
 
-	for (auto EnemyHandle : EnemyArray)
+	// Entities are hit when their bounds touch the circle, so search as far as the biggest radius reaches
+	Snapshot.ForEachCellInRadiusPruned(FVector2D(InLocation),Radius+Snapshot.GetMaxRadius(),CellSize, [OwnTeam](const FSmbGridCoarseCellView& CoarseCell)
 	{
-		if (!EntityManagerPtr->IsEntityValid(EnemyHandle)) continue;
-		FTransformFragment* TransformFragment = EntityManagerPtr->GetFragmentDataPtr<FTransformFragment>(EnemyHandle);
-		if (!TransformFragment) continue;
-		FVector EnemyLocation = TransformFragment->GetMutableTransform().GetLocation();
-		FAgentRadiusFragment* AgentRadiusFrag = EntityManagerPtr->GetFragmentDataPtr<FAgentRadiusFragment>(EnemyHandle);
-		if (!AgentRadiusFrag) continue;
-		if ((EnemyLocation-InLocation).Size()>Radius+AgentRadiusFrag->Radius) continue;
-		FDefenceFragment* DefenceFragment = EntityManagerPtr->GetFragmentDataPtr<FDefenceFragment>(EnemyHandle);
-		if (!DefenceFragment) continue;
-		if (DefenceFragment->HP <= 0) continue;
-		FTeamFragment* TeamFragment = EntityManagerPtr->GetFragmentDataPtr<FTeamFragment>(EnemyHandle);
-		if (!TeamFragment) continue;
-		if (TeamFragment->TeamID == OwnTeam) continue;
-		Signaled.Add(EnemyHandle);
-		if (DamageType == EDamageType::Blunt && DefenceFragment->UnitArmor == EArmorType::HeavyArmor)
-			DamageAmount *= 2;
-		if (DamageType == EDamageType::Slashing && DefenceFragment->UnitArmor == EArmorType::LightArmor)
-			DamageAmount *= 2;
-		if (DamageType == EDamageType::Piercing && DefenceFragment->UnitArmor == EArmorType::MediumArmor)
-			DamageAmount *= 2;
-		DefenceFragment->HP -= DamageAmount;
-		if (DefenceFragment->HP <= 0)
+		return CoarseCell.HasTargetableEnemyOf(OwnTeam);
+	}, [&](const FSmbGridCellView& CellView)
+	{
+		// Cells are sorted by team, friendly runs are skipped without looking at their entities
+		for (const FSmbGridTeamRun& Run : CellView.TeamRuns)
 		{
-			DefenceFragment->HP = 0;
-			AmountKilled += 1;
+			if (Run.Team == FSmbSpatialGrid::NoTeam || Run.Team == OwnTeam) continue;
+			for (int32 Slot = Run.Start; Slot < Run.Start+Run.Num; ++Slot)
+			{
+				if (!CellView.IsDamageable(Slot) || !CellView.IsAlive(Slot)) continue;
+				if ((CellView.GetLocation(Slot)-InLocation).Size()>Radius+CellView.Radius[Slot]) continue;
+
+				const FMassEntityHandle EnemyHandle = CellView.Handles[Slot];
+				if (!EntityManagerPtr->IsEntityValid(EnemyHandle)) continue;
+				FDefenceFragment* DefenceFragment = EntityManagerPtr->GetFragmentDataPtr<FDefenceFragment>(EnemyHandle);
+				if (!DefenceFragment) continue;
+				if (DefenceFragment->HP <= 0) continue;
+				Signaled.Add(EnemyHandle);
+				if (DamageType == EDamageType::Blunt && DefenceFragment->UnitArmor == EArmorType::HeavyArmor)
+					DamageAmount *= 2;
+				if (DamageType == EDamageType::Slashing && DefenceFragment->UnitArmor == EArmorType::LightArmor)
+					DamageAmount *= 2;
+				if (DamageType == EDamageType::Piercing && DefenceFragment->UnitArmor == EArmorType::MediumArmor)
+					DamageAmount *= 2;
+				DefenceFragment->HP -= DamageAmount;
+				if (DefenceFragment->HP <= 0)
+				{
+					DefenceFragment->HP = 0;
+					AmountKilled += 1;
+				}
+				Influence.SetStrength(EnemyHandle, DefenceFragment->HP);
+			}
 		}
-	}
+	});
 
 	//UE_LOG(LogTemp, Warning, TEXT("Signaled %i units"), Signaled.Num());
 	if (Signaled.Num() <= 0) return false;
+	WakeEntities(Signaled);
 	SignalSubsystem->DelaySignalEntities(Smb::Signals::ReceivedDamage,Signaled,0.001f);
 	
 	return true;
@@ -643,9 +934,8 @@ bool USmbSubsystem::AddProjectile(FVector SpawnVector, FVector TargetVector, USm
 void USmbSubsystem::DestroyEntity(FMassEntityHandle Handle)
 {
 	if (!EntityManagerPtr->IsEntityValid(Handle)) return;
-	FLocationDataFragment* DataFragment = EntityManagerPtr->GetFragmentDataPtr<FLocationDataFragment>(Handle);
-	FVector2D OldCell = VectorToCell(DataFragment->OldLocation);
-	Grid->RemoveAt(OldCell.X,OldCell.Y,Handle);
+	Grid.RemoveFromGrid(Handle);
+	Influence.Remove(Handle);
 	EntityManagerPtr->Defer().DestroyEntity(Handle);
 }
 
@@ -712,8 +1002,11 @@ bool USmbSubsystem::MoveEntities(TArray<FSmbEntityData> Units, FVector NewLocati
 	}
 	if (Handles.Num() <= 0) return false;
 
+	// Units the order applies to and the area they start from, one flow field has to cover all of them
+	TArray<FMassEntityHandle> OrderedHandles;
+	FBox2D OrderBounds(ForceInit);
+	float MaxRadius = 0.f;
 	for (auto Handle : Handles){
-		FLocationDataFragment* DataFragment = EntityManagerPtr->GetFragmentDataPtr<FLocationDataFragment>(Handle);
 		if (FTeamFragment* TeamFragment = EntityManagerPtr->GetFragmentDataPtr<FTeamFragment>(Handle))
 		{
 			if (TeamFragment->TeamID != Team) continue;
@@ -722,35 +1015,40 @@ bool USmbSubsystem::MoveEntities(TArray<FSmbEntityData> Units, FVector NewLocati
 		{
 			if (DefenceFragment->HP <= 0) continue;
 		}
+		OrderedHandles.Add(Handle);
+		if (FTransformFragment* TransformFragment = EntityManagerPtr->GetFragmentDataPtr<FTransformFragment>(Handle))
+		{
+			OrderBounds += FVector2D(TransformFragment->GetTransform().GetLocation());
+		}
+		if (FAgentRadiusFragment* RadiusFragment = EntityManagerPtr->GetFragmentDataPtr<FAgentRadiusFragment>(Handle))
+		{
+			MaxRadius = FMath::Max(MaxRadius, RadiusFragment->Radius);
+		}
+	}
+
+	// Units spread over a square around NewLocation, the field treats the circle around that square as its destination
+	const float Spread = FMath::Pow(Handles.Num(),0.71f);
+	const int32 FlowFieldId = OrderedHandles.Num() > 0 ? RequestFlowField(NewLocation, 0.5f*UE_SQRT_2*Spread*MaxRadius, OrderBounds) : INDEX_NONE;
+
+	for (auto Handle : OrderedHandles){
+		FLocationTargetFragment* DataFragment = EntityManagerPtr->GetFragmentDataPtr<FLocationTargetFragment>(Handle);
 		FVector RandomisedTargetOffset = FVector(FMath::FRand()-0.5f,FMath::FRand()-0.5f,0);
 
-		// Nav Trace Result
-		//FNavResult NavLocation = FNavLocation();
+		// No navmesh projection per unit anymore, the flow field keeps the way on the navmesh and the walk target task snaps the end
 		if (FAgentRadiusFragment* RadiusFragment = EntityManagerPtr->GetFragmentDataPtr<FAgentRadiusFragment>(Handle))
 		{
-			FVector LocationToCheck = NewLocation + RandomisedTargetOffset*FMath::Pow(Handles.Num(),0.71f)*RadiusFragment->Radius;
-			
-			if (UNavigationSystemV1* NavSys = FNavigationSystem::GetCurrent<UNavigationSystemV1>(GetWorld()))
-			{
-				FNavLocation NavLocation;
-				if (NavSys->ProjectPointToNavigation(LocationToCheck, NavLocation, FVector(25.0f, 25.0f, 2500.0f)))
-				{
-					DataFragment->WalkToLocation = NavLocation.Location;
-				}
-				else // Failed fallback
-				{
-					DataFragment->WalkToLocation = LocationToCheck;
-				}
-			}
-			else
-			{
-				DataFragment->WalkToLocation = LocationToCheck;
-			}
+			DataFragment->WalkToLocation = NewLocation + RandomisedTargetOffset*Spread*RadiusFragment->Radius;
+		}
+		if (FSmbFlowFollowerFragment* FollowerFragment = EntityManagerPtr->GetFragmentDataPtr<FSmbFlowFollowerFragment>(Handle))
+		{
+			FollowerFragment->FlowFieldId = FlowFieldId;
+			FollowerFragment->Destination = DataFragment->WalkToLocation;
 		}
 		DataFragment->bNewLocation = true;
 	}
 	//UE_LOG(LogTemp, Warning, TEXT("Moved %i units"), Handles.Num());
 
+	WakeEntities(Handles);
 	//Signal that entities have to refresh StateTree
 	UMassSignalSubsystem* SignalSubsystem = GetWorld()->GetSubsystem<UMassSignalSubsystem>();
 	SignalSubsystem->SignalEntities(Smb::Signals::MoveTargetChanged,Handles);
@@ -758,42 +1056,185 @@ bool USmbSubsystem::MoveEntities(TArray<FSmbEntityData> Units, FVector NewLocati
 }
 
 
-//Gets entities at location in the grid, max X and Y and min X and Y, then it appends ones with the correct team 
-TArray<FSmbEntityData> USmbSubsystem::SelectEntitiesInside(FVector TopLeftLocation, FVector BottomRightLocation, int32 Team, float YawRotation)
+int32 USmbSubsystem::RequestFlowField(const FVector& Goal, float GoalRadius, const FBox2D& Bounds)
 {
-	FVector2D TopLeftCell = VectorToCell(TopLeftLocation);
-	FVector2D BottomRightCell = VectorToCell(BottomRightLocation);
-	float Radius = FMath::Abs(TopLeftCell.Y-BottomRightCell.Y)+FMath::Abs(TopLeftCell.X-BottomRightCell.X);
-	TArray<FMassEntityHandle> Handles = Grid->GetAround((TopLeftCell.X+BottomRightCell.X)/2,(TopLeftCell.Y+BottomRightCell.Y)/2,Radius);
-	TArray<FSmbEntityData> SelectedEntities = TArray<FSmbEntityData>();
-	for (auto Handle : Handles)
+	const double Now = GetWorld()->GetTimeSeconds();
+	for (TPair<int32, FFlowFieldEntry>& FlowField : FlowFields)
 	{
-		if (!EntityManagerPtr->IsEntityValid(Handle)) continue;
-		if (FTeamFragment* TeamFragment = EntityManagerPtr->GetFragmentDataPtr<FTeamFragment>(Handle))
+		FSmbFlowField& Field = *FlowField.Value.Field;
+		if (Now-Field.CreationTime > FlowFieldMaxAge) continue;
+		if (!Field.CanServe(Goal, GoalRadius, Bounds)) continue;
+		Field.LastUsedTime = Now;
+		return FlowField.Key;
+	}
+
+	UNavigationSystemV1* NavSys = FNavigationSystem::GetCurrent<UNavigationSystemV1>(GetWorld());
+	const ANavigationData* NavData = NavSys ? NavSys->GetDefaultNavDataInstance() : nullptr;
+	if (!NavData || NavSys->IsNavigationBuildInProgress()) return INDEX_NONE;
+
+	// Make room by dropping the least recently used field that is done building, followers of it fall back to plain steering
+	while (FlowFields.Num() >= FMath::Max(MaxCachedFlowFields, 1))
+	{
+		int32 OldestId = INDEX_NONE;
+		double OldestTime = TNumericLimits<double>::Max();
+		for (const TPair<int32, FFlowFieldEntry>& FlowField : FlowFields)
 		{
-			if (TeamFragment->TeamID != Team && Team != -1) continue;
+			if (!FlowField.Value.Field->IsReady()) continue;
+			if (FlowField.Value.Field->LastUsedTime >= OldestTime) continue;
+			OldestTime = FlowField.Value.Field->LastUsedTime;
+			OldestId = FlowField.Key;
 		}
-		FTransformFragment* TransformFragment = EntityManagerPtr->GetFragmentDataPtr<FTransformFragment>(Handle);
-		if (!TransformFragment) continue;
-		FVector2D EnemyLocation = FVector2D(TransformFragment->GetTransform().GetLocation().X,TransformFragment->GetTransform().GetLocation().Y);
-		FVector2D TopLeft2D = FVector2D(TopLeftLocation.X,TopLeftLocation.Y);
-		FVector2D BottomRight2D = FVector2D(BottomRightLocation.X,BottomRightLocation.Y);
-		FVector2D RectCenter = (TopLeft2D+BottomRight2D)/2;
-		FVector2D Extents = FVector2D(FMath::Abs(TopLeft2D.X-BottomRight2D.X)/2,FMath::Abs(TopLeft2D.Y-BottomRight2D.Y)/2);
-		float YawRad = FMath::DegreesToRadians(YawRotation);
-		FVector2D UnitAxisX(FMath::Cos(YawRad), FMath::Sin(YawRad));
-		
-		//2D Rotated Selection Box
-		UE::Geometry::FOrientedBox2d SelectionBox = UE::Geometry::FOrientedBox2d(RectCenter, UnitAxisX, Extents);
-		bool bIsInside = SelectionBox.Contains(EnemyLocation);
-		if (!bIsInside) continue;
-		
-		if (FDefenceFragment* DefenceFragment = EntityManagerPtr->GetFragmentDataPtr<FDefenceFragment>(Handle))
+		if (OldestId == INDEX_NONE) break;
+		FlowFields.Remove(OldestId);
+	}
+
+	FBox2D FieldBounds = Bounds;
+	FieldBounds += FVector2D(Goal);
+	FieldBounds = FieldBounds.ExpandBy(GoalRadius+FlowFieldMargin);
+	const float FieldCellSize = FMath::Max(FlowFieldCellSize, static_cast<float>(FieldBounds.GetSize().GetMax())/FMath::Max(MaxFlowFieldCellsPerSide, 1));
+
+	FFlowFieldEntry& Entry = FlowFields.Add(NextFlowFieldId);
+	Entry.Field = MakeShared<FSmbFlowField, ESPMode::ThreadSafe>(Goal, GoalRadius, FieldBounds, FieldCellSize);
+	Entry.Field->CreationTime = Now;
+	Entry.Field->LastUsedTime = Now;
+	// Sampled by the next ticks, the navmesh is only read on the game thread while its updates are held back
+	return NextFlowFieldId++;
+}
+
+void USmbSubsystem::AdvanceFlowFieldBuilds()
+{
+	int32 SamplesLeft = MaxFlowFieldSamplesPerFrame;
+	for (TPair<int32, FFlowFieldEntry>& FlowField : FlowFields)
+	{
+		FFlowFieldEntry& Entry = FlowField.Value;
+		if (Entry.BuildTask.IsValid()) continue;
+		if (!Entry.Field->IsSampled())
 		{
-			if (DefenceFragment->HP <= 0) continue;
+			if (SamplesLeft <= 0) continue;
+			SamplesLeft -= Entry.Field->SampleWalkable(*GetWorld(), 2500.f, SamplesLeft);
+			if (!Entry.Field->IsSampled()) continue;
 		}
-		SelectedEntities.Add(FSmbEntityData(Handle));
+		// The cost integration only reads the samples, the navmesh may change under it
+		Entry.BuildTask = UE::Tasks::Launch(UE_SOURCE_LOCATION, [Field = Entry.Field]()
+		{
+			Field->Build();
+		});
 	}
+}
+
+void USmbSubsystem::ApplyNavProjections()
+{
+	for (const FSmbNavProjection& Projection : NavProjections.GetResults())
+	{
+		if (!EntityManagerPtr->IsEntityValid(Projection.Owner)) continue;
+		if (Projection.Purpose == ESmbNavProjectionPurpose::Height)
+		{
+			FHeightFragment* HeightFragment = EntityManagerPtr->GetFragmentDataPtr<FHeightFragment>(Projection.Owner);
+			if (!HeightFragment || !Projection.bFound) continue;
+			HeightFragment->TargetHeight = Projection.Location.Z;
+			// Only found further out, the entity left the navmesh and is put back on it
+			if (Projection.bFoundWithFallback)
+			{
+				if (FTransformFragment* TransformFragment = EntityManagerPtr->GetFragmentDataPtr<FTransformFragment>(Projection.Owner))
+				{
+					TransformFragment->GetMutableTransform().SetLocation(Projection.Location);
+					HeightFragment->CurrentHeight = Projection.Location.Z;
+				}
+			}
+			continue;
+		}
+		if (Projection.Purpose != ESmbNavProjectionPurpose::WalkTarget) continue;
+		// Tasks walk towards the raw point until the projection is in, only targets still pointing there are moved
+		if (FLocationTargetFragment* LocationTargetFragment = EntityManagerPtr->GetFragmentDataPtr<FLocationTargetFragment>(Projection.Owner))
+		{
+			if (FVector::PointsAreNear(LocationTargetFragment->WalkToLocation, Projection.Point, 1.f))
+			{
+				LocationTargetFragment->WalkToLocation = Projection.Location;
+			}
+		}
+		if (FMassMoveTargetFragment* MoveTargetFragment = EntityManagerPtr->GetFragmentDataPtr<FMassMoveTargetFragment>(Projection.Owner))
+		{
+			if (FVector::PointsAreNear(MoveTargetFragment->Center, Projection.Point, 1.f))
+			{
+				MoveTargetFragment->Center = Projection.Location;
+			}
+		}
+	}
+}
+
+void USmbSubsystem::BindNavigationInvalidation()
+{
+	if (InvalidationNavSys.IsValid()) return;
+	UNavigationSystemV1* NavSys = FNavigationSystem::GetCurrent<UNavigationSystemV1>(GetWorld());
+	if (!NavSys) return;
+	NavSys->OnNavigationGenerationFinishedDelegate.AddUniqueDynamic(this, &USmbSubsystem::OnNavigationGenerationFinished);
+	InvalidationNavSys = NavSys;
+	// Anything cached before binding may predate a rebuild that was missed
+	HeightCache.Invalidate();
+}
+
+void USmbSubsystem::OnNavigationGenerationFinished(ANavigationData* NavData)
+{
+	// Rebuilt tiles are not reported per area, the whole cache is refilled lazily
+	HeightCache.Invalidate();
+	// Builds that started on the old tiles are thrown away, their followers steer straight until the next order
+	CancelFlowFieldBuilds();
+}
+
+void USmbSubsystem::CancelFlowFieldBuilds()
+{
+	for (auto It = FlowFields.CreateIterator(); It; ++It)
+	{
+		if (It->Value.Field->IsReady()) continue;
+		It->Value.Field->Cancel();
+		if (It->Value.BuildTask.IsValid())
+		{
+			It->Value.BuildTask.Wait();
+		}
+		It.RemoveCurrent();
+	}
+}
+
+const FSmbFlowField* USmbSubsystem::FindReadyFlowField(int32 FlowFieldId) const
+{
+	const FFlowFieldEntry* Entry = FlowFields.Find(FlowFieldId);
+	if (!Entry || !Entry->Field->IsReady()) return nullptr;
+	return Entry->Field.Get();
+}
+
+//Gets entities at location in the grid, max X and Y and min X and Y, then it appends ones with the correct team 
+TArray<FSmbEntityData> USmbSubsystem::SelectEntitiesInside(FVector TopLeftLocation, FVector BottomRightLocation, int32 Team, float YawRotation)
+{
+	TArray<FSmbEntityData> SelectedEntities = TArray<FSmbEntityData>();
+	FVector2D TopLeft2D = FVector2D(TopLeftLocation.X,TopLeftLocation.Y);
+	FVector2D BottomRight2D = FVector2D(BottomRightLocation.X,BottomRightLocation.Y);
+	FVector2D RectCenter = (TopLeft2D+BottomRight2D)/2;
+	FVector2D Extents = FVector2D(FMath::Abs(TopLeft2D.X-BottomRight2D.X)/2,FMath::Abs(TopLeft2D.Y-BottomRight2D.Y)/2);
+	float YawRad = FMath::DegreesToRadians(YawRotation);
+	FVector2D UnitAxisX(FMath::Cos(YawRad), FMath::Sin(YawRad));
+	
+	//2D Rotated Selection Box
+	UE::Geometry::FOrientedBox2d SelectionBox = UE::Geometry::FOrientedBox2d(RectCenter, UnitAxisX, Extents);
+	// World aligned bounds of the rotated box, only cells under these can hold selected entities
+	const FVector2D BoundsExtent = FVector2D(
+		FMath::Abs(UnitAxisX.X)*Extents.X+FMath::Abs(UnitAxisX.Y)*Extents.Y,
+		FMath::Abs(UnitAxisX.Y)*Extents.X+FMath::Abs(UnitAxisX.X)*Extents.Y);
+	const FBox2D SelectionBounds = FBox2D(RectCenter-BoundsExtent, RectCenter+BoundsExtent);
+
+	GetGridSnapshot().ForEachCellInBounds(SelectionBounds,CellSize, [&](const FSmbGridCellView& CellView)
+	{
+		for (int32 Slot = 0; Slot < CellView.Num(); ++Slot)
+		{
+			const int32 OtherTeam = CellView.Team[Slot];
+			if (OtherTeam != FSmbSpatialGrid::NoTeam && OtherTeam != Team && Team != -1) continue;
+			if (!CellView.IsAlive(Slot)) continue;
+			FVector2D EnemyLocation = FVector2D(CellView.X[Slot],CellView.Y[Slot]);
+			bool bIsInside = SelectionBox.Contains(EnemyLocation);
+			if (!bIsInside) continue;
+			if (!EntityManagerPtr->IsEntityValid(CellView.Handles[Slot])) continue;
+			SelectedEntities.Add(FSmbEntityData(CellView.Handles[Slot]));
+		}
+	});
 
 	//UE_LOG(LogTemp, Warning, TEXT("Selected %i entities"), SelectedEntities.Num());
 
@@ -842,8 +1283,10 @@ void USmbSubsystem::DamageSelectedEntities(TArray<FSmbEntityData> SelectedEntiti
 			DefenceFragment->HP = 0;
 			AmountKilled += 1;
 		}
+		Influence.SetStrength(EnemyHandle, DefenceFragment->HP);
 		
 		if (Signaled.Num() <= 0) return;
+		WakeEntities(Signaled);
 		SignalSubsystem->DelaySignalEntities(Smb::Signals::ReceivedDamage,Signaled,0.001f);
 	}
 }
@@ -911,83 +1354,10 @@ bool USmbSubsystem::DestroyAgentEntity(UMassAgentComponent* MassAgentComponent)
 }
 
 
-FVector2D USmbSubsystem::VectorToCell(FVector Location)
+FVector2D USmbSubsystem::VectorToCell(FVector Location) const
 {
-	int32 X = static_cast<int32>(Location.X/CellSize);
-	int32 Y = static_cast<int32>(Location.Y/CellSize);
+	// Floored so the cells either side of zero don't both cover -CellSize..CellSize
+	int32 X = FMath::FloorToInt32(Location.X/CellSize);
+	int32 Y = FMath::FloorToInt32(Location.Y/CellSize);
 	return FVector2D(X, Y);
 }
-
-TArray<FMassEntityHandle> UGrid::GetAt(int32 X, int32 Y)
-{
-	if (!XCells.Contains(X)) return TArray<FMassEntityHandle>();
-	UGridCellY* CellY = XCells[X];
-	if (!CellY) return TArray<FMassEntityHandle>();
-	if (!CellY->YCells.Contains(Y)) return TArray<FMassEntityHandle>();
-	UGridCell* Cell = CellY->YCells[Y];
-	if (!Cell) return TArray<FMassEntityHandle>();
-	return Cell->Handles;
-}
-
-TArray<FMassEntityHandle> UGrid::RemoveAt(int32 X, int32 Y, FMassEntityHandle ToRemoveHandle)
-{
-	if (!XCells.Contains(X)) return TArray<FMassEntityHandle>();
-	UGridCellY* CellY = XCells[X];
-	if (!CellY) return TArray<FMassEntityHandle>();
-	if (!CellY->YCells.Contains(Y)) return TArray<FMassEntityHandle>();
-	UGridCell* Cell = CellY->YCells[Y];
-	if (!Cell) return TArray<FMassEntityHandle>();
-	Cell->Handles.Remove(ToRemoveHandle);
-	return Cell->Handles;
-}
-
-TArray<FMassEntityHandle> UGrid::GetAround(int32 X, int32 Y, int32 Radius)
-{
-	TArray<FMassEntityHandle> Handles = TArray<FMassEntityHandle>();
-	for (int i = -Radius; i < Radius; ++i)
-	{
-		for (int j = -Radius; j < Radius; ++j)
-		{
-			Handles.Append(GetAt(X+i,Y+j));
-		}
-	}
-	
-	return Handles;
-}
-
-void UGrid::AddToGrid(int32 X, int32 Y, FMassEntityHandle Handle)
-{
-	if (!XCells.Contains(X)) XCells.Add(X, NewObject<UGridCellY>());
-	UGridCellY* CellY = XCells[X];
-	//if (!CellY) CellY = NewObject<UGridCellY>();
-	if (!CellY->YCells.Contains(Y)) CellY->YCells.Add(Y, NewObject<UGridCell>());
-	UGridCell* Cell = CellY->YCells[Y];
-	//if (!Cell) Cell = NewObject<UGridCell>();
-	Cell->Handles.Add(Handle);
-}
-
-void UGridCell::EmptySelf()
-{
-	Handles.Empty();
-	this->MarkAsGarbage();
-}
-
-void UGridCellY::EmptySelf()
-{
-	//For pair empty pointer
-	for (auto& [Key, Value] : YCells)
-	{
-		Value->EmptySelf();
-	}
-	this->MarkAsGarbage();
-}
-
-void UGrid::EmptySelf()
-{
-	for (auto& [Key, Value] : XCells)
-	{
-		Value->EmptySelf();
-	}
-	this->MarkAsGarbage();
-}
-
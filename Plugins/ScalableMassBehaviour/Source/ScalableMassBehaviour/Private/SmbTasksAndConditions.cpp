@@ -54,6 +54,41 @@ EStateTreeRunStatus FGetOwnLocation::EnterState(FStateTreeExecutionContext& Cont
 
 
 
+FGetThreatDirection::FGetThreatDirection()
+{
+}
+
+bool FGetThreatDirection::Link(FStateTreeLinker& Linker)
+{
+	Linker.LinkExternalData(EntityTransformHandle);
+	Linker.LinkExternalData(TeamFragmentHandle);
+	Linker.LinkExternalData(SmbSubsystemHandle);
+	return true;
+}
+
+void FGetThreatDirection::GetDependencies(UE::MassBehavior::FStateTreeDependencyBuilder& Builder) const
+{
+	Builder.AddReadOnly(EntityTransformHandle);
+	Builder.AddReadOnly(TeamFragmentHandle);
+	Builder.AddReadOnly(SmbSubsystemHandle);
+}
+
+EStateTreeRunStatus FGetThreatDirection::EnterState(FStateTreeExecutionContext& Context, const FStateTreeTransitionResult& Transition) const
+{
+	FInstanceDataType& InstanceData = Context.GetInstanceData(*this);
+	const FTransformFragment& EntityTransform = Context.GetExternalData(EntityTransformHandle);
+	const FTeamFragment& TeamFragment = Context.GetExternalData(TeamFragmentHandle);
+	const USmbSubsystem& SmbSubsystem = Context.GetExternalData(SmbSubsystemHandle);
+
+	// Nine influence cell lookups, no matter how many enemies are around
+	const bool bFoundThreat = SmbSubsystem.GetStrongestThreatDirection(EntityTransform.GetTransform().GetLocation(),
+		TeamFragment.TeamID, InstanceData.ThreatDirection, InstanceData.ThreatStrength);
+
+	return bFoundThreat ? EStateTreeRunStatus::Succeeded : EStateTreeRunStatus::Failed;
+}
+
+
+
 FGetRandomLocationInRange::FGetRandomLocationInRange()
 {
 	bShouldCallTick = false;
@@ -65,8 +100,9 @@ bool FGetRandomLocationInRange::Link(FStateTreeLinker& Linker)
 	//Linker.LinkExternalData(EntityTransformHandle);
 	Linker.LinkExternalData(AnimationFragmentHandle);
 	Linker.LinkExternalData(DeathFragmentHandle);
-	Linker.LinkExternalData(LocationDataFragmentHandle);
+	Linker.LinkExternalData(LocationTargetFragmentHandle);
 	Linker.LinkExternalData(TransformFragmentHandle);
+	Linker.LinkExternalData(SmbSubsystemHandle);
 	//Linker.LinkExternalData(NavigationSystemHandle);
 	return true;
 }
@@ -75,8 +111,9 @@ void FGetRandomLocationInRange::GetDependencies(UE::MassBehavior::FStateTreeDepe
 {
 	Builder.AddReadWrite(AnimationFragmentHandle);
 	Builder.AddReadWrite(DeathFragmentHandle);
-	Builder.AddReadWrite(LocationDataFragmentHandle);
+	Builder.AddReadWrite(LocationTargetFragmentHandle);
 	Builder.AddReadOnly(TransformFragmentHandle);
+	Builder.AddReadWrite(SmbSubsystemHandle);
 	//Builder.AddReadWrite(NavigationSystemHandle);
 }
 
@@ -97,15 +134,15 @@ EStateTreeRunStatus FGetRandomLocationInRange::EnterState(FStateTreeExecutionCon
 	}
 	FTransformFragment& TransformFragment = Context.GetExternalData(TransformFragmentHandle);
 	FVector Location = TransformFragment.GetTransform().GetLocation();
-	FLocationDataFragment LocationDataFragment = Context.GetExternalData(LocationDataFragmentHandle);
+	FLocationTargetFragment LocationTargetFragment = Context.GetExternalData(LocationTargetFragmentHandle);
 
 	
-	if (LocationDataFragment.WalkToLocation != FVector::DownVector && !InstanceData.bNewLocation)
+	if (LocationTargetFragment.WalkToLocation != FVector::DownVector && !InstanceData.bNewLocation)
 	{
 		FVector RandomOffset = FVector::ZeroVector;
 		RandomOffset.X += FMath::FRandRange(-InstanceData.RandomRadiusRange, InstanceData.RandomRadiusRange);
 		RandomOffset.Y += FMath::FRandRange(-InstanceData.RandomRadiusRange, InstanceData.RandomRadiusRange);
-		RandomLocation = LocationDataFragment.WalkToLocation + RandomOffset;
+		RandomLocation = LocationTargetFragment.WalkToLocation + RandomOffset;
 		
 		if ((Location-RandomLocation).Size() <= InstanceData.AcceptableWalkRadius)
 		{
@@ -116,14 +153,18 @@ EStateTreeRunStatus FGetRandomLocationInRange::EnterState(FStateTreeExecutionCon
 		}
 	}
 	
-	//The way they did it in MassNavMeshTask
-	UNavigationSystemV1* NavMeshSubsystem = Cast<UNavigationSystemV1>(Context.GetWorld()->GetNavigationSystem());
-	FNavLocation NavLocation;
-	bool bFoundLocation = NavMeshSubsystem->ProjectPointToNavigation(RandomLocation,NavLocation, FVector(300,300,300));
-	if (!bFoundLocation) return EStateTreeRunStatus::Failed;
+	// Walks towards the raw point, the subsystem moves the target onto the navmesh next frame or stops the entity where it is if there is none
+	USmbSubsystem& SmbSubsystem = Context.GetExternalData(SmbSubsystemHandle);
+	FSmbNavProjection Projection;
+	Projection.Owner = MassStateTreeContext.GetEntity();
+	Projection.Purpose = ESmbNavProjectionPurpose::WalkTarget;
+	Projection.Point = RandomLocation;
+	Projection.Extent = FVector(300,300,300);
+	Projection.FailLocation = Location;
+	SmbSubsystem.QueueNavProjection(Projection);
 
 	FMassTargetLocation OutLocation = FMassTargetLocation();
-	OutLocation.EndOfPathPosition = NavLocation.Location;
+	OutLocation.EndOfPathPosition = RandomLocation;
 	OutLocation.EndOfPathIntent = EMassMovementAction::Stand;
 
 	InstanceData.TargetLocation = OutLocation;
@@ -199,7 +240,7 @@ bool FNavDoneCondition::TestCondition(FStateTreeExecutionContext& Context) const
 bool FIsCloseEnoughCondition::Link(FStateTreeLinker& Linker)
 {
 	Linker.LinkExternalData(EntityTransformHandle);
-	Linker.LinkExternalData(LocationDataFragmentHandle);
+	Linker.LinkExternalData(LocationTargetFragmentHandle);
 	Linker.LinkExternalData(AnimationFragmentHandle);
 
 	return true;
@@ -213,13 +254,13 @@ bool FIsCloseEnoughCondition::TestCondition(FStateTreeExecutionContext& Context)
 	
 	const FTransformFragment& TransformFragment = Context.GetExternalData(EntityTransformHandle);
 	const FVector EntityLocation = TransformFragment.GetTransform().GetLocation();
-	const FLocationDataFragment LocationDataFragment = Context.GetExternalData(LocationDataFragmentHandle);
+	const FLocationTargetFragment LocationTargetFragment = Context.GetExternalData(LocationTargetFragmentHandle);
 	FAnimationFragment& AnimationFragment = Context.GetExternalData(AnimationFragmentHandle);
 	
 	float Distance;
 	if (bUseInternalWalkTarget)
 	{
-		Distance = (LocationDataFragment.WalkToLocation - EntityLocation).Size();
+		Distance = (LocationTargetFragment.WalkToLocation - EntityLocation).Size();
 		AnimationFragment.CurrentState = EAnimationState::Idle;
 	} else
 	{
@@ -482,7 +523,7 @@ bool FWalkToEntityLocation::Link(FStateTreeLinker& Linker)
 	Linker.LinkExternalData(AnimationFragmentHandle);
 	Linker.LinkExternalData(NearEnemiesFragHandle);
 	Linker.LinkExternalData(MassSignalSubsystemHandle);
-	Linker.LinkExternalData(LocationDataFragHandle);
+	Linker.LinkExternalData(LocationTargetFragHandle);
 	return true;
 }
 
@@ -493,7 +534,7 @@ void FWalkToEntityLocation::GetDependencies(UE::MassBehavior::FStateTreeDependen
 	Builder.AddReadWrite(AnimationFragmentHandle);
 	Builder.AddReadWrite(NearEnemiesFragHandle);
 	Builder.AddReadWrite(MassSignalSubsystemHandle);
-	Builder.AddReadWrite(LocationDataFragHandle);
+	Builder.AddReadWrite(LocationTargetFragHandle);
 }
 
 EStateTreeRunStatus FWalkToEntityLocation::EnterState(FStateTreeExecutionContext& Context, const FStateTreeTransitionResult& Transition) const
@@ -503,7 +544,7 @@ EStateTreeRunStatus FWalkToEntityLocation::EnterState(FStateTreeExecutionContext
 	USmbSubsystem& SmbSubsystem = Context.GetExternalData(SmbSubsystemHandle);
 	FAnimationFragment& AnimationFragment = Context.GetExternalData(AnimationFragmentHandle);
 	FTransform& Transform = Context.GetExternalData(EntityTransformHandle).GetMutableTransform();
-	FLocationDataFragment& LocationDataFragment = Context.GetExternalData(LocationDataFragHandle);
+	FLocationTargetFragment& LocationTargetFragment = Context.GetExternalData(LocationTargetFragHandle);
 
 	AnimationFragment.CurrentState = EAnimationState::Running;
 
@@ -517,17 +558,22 @@ EStateTreeRunStatus FWalkToEntityLocation::EnterState(FStateTreeExecutionContext
 	
 	if (SmbSubsystem.IsEntityValidManager(NearEnemies.ClosestEnemies[0])){
 		const FVector EntityLoc = SmbSubsystem.GetEntityLocation(NearEnemies.ClosestEnemies[0]);
-		UNavigationSystemV1* NavMeshSubsystem = Cast<UNavigationSystemV1>(Context.GetWorld()->GetNavigationSystem());
-		FNavLocation NavLocation;
-		bool FoundLocation = NavMeshSubsystem->ProjectPointToNavigation((EntityLoc-Transform.GetLocation())/1.5f+Transform.GetLocation(),NavLocation, FVector(InstanceData.DistanceAway,InstanceData.DistanceAway,400.f));
-		if (!FoundLocation) return EStateTreeRunStatus::Failed;
-		if (!LocationDataFragment.bIsAttackLocation)
+		const FVector ApproachLocation = (EntityLoc-Transform.GetLocation())/1.5f+Transform.GetLocation();
+		// Projected at the end of the frame, without navmesh near the enemy the entity stays where it is
+		FSmbNavProjection Projection;
+		Projection.Owner = MassStateTreeContext.GetEntity();
+		Projection.Purpose = ESmbNavProjectionPurpose::WalkTarget;
+		Projection.Point = ApproachLocation;
+		Projection.Extent = FVector(InstanceData.DistanceAway,InstanceData.DistanceAway,400.f);
+		Projection.FailLocation = Transform.GetLocation();
+		SmbSubsystem.QueueNavProjection(Projection);
+		if (!LocationTargetFragment.bIsAttackLocation)
 		{
-			LocationDataFragment.PrevWalkToLocationBeforeAttack = FVector(LocationDataFragment.WalkToLocation);
-			LocationDataFragment.bIsAttackLocation = true;
+			LocationTargetFragment.PrevWalkToLocationBeforeAttack = FVector(LocationTargetFragment.WalkToLocation);
+			LocationTargetFragment.bIsAttackLocation = true;
 		}
-		LocationDataFragment.WalkToLocation = NavLocation.Location;
-		OutLocation.EndOfPathPosition = NavLocation.Location;
+		LocationTargetFragment.WalkToLocation = ApproachLocation;
+		OutLocation.EndOfPathPosition = ApproachLocation;
 	}
 
 	OutLocation.EndOfPathIntent = EMassMovementAction::Stand;
@@ -651,7 +697,7 @@ bool FAttackWithSkill::Link(FStateTreeLinker& Linker)
 	Linker.LinkExternalData(TeamFragmentHandle);
 	Linker.LinkExternalData(NearEnemiesFragHandle);;
 	Linker.LinkExternalData(MassRepFragmentHandle);
-	Linker.LinkExternalData(LocationDataHandle);
+	Linker.LinkExternalData(LocationTargetHandle);
 	Linker.LinkExternalData(AbilityDataHandle);
 	return true;
 }
@@ -666,7 +712,7 @@ void FAttackWithSkill::GetDependencies(UE::MassBehavior::FStateTreeDependencyBui
 	Builder.AddReadWrite(TeamFragmentHandle);
 	Builder.AddReadWrite(NearEnemiesFragHandle);
 	Builder.AddReadWrite(MassSignalSubsystemHandle);
-	Builder.AddReadWrite(LocationDataHandle);
+	Builder.AddReadWrite(LocationTargetHandle);
 	Builder.AddReadWrite(AbilityDataHandle);
 }
 
@@ -742,7 +788,7 @@ EStateTreeRunStatus FListenEnemy::EnterState(FStateTreeExecutionContext& Context
 	
 	FListenEnemyInstanceData& InstanceData = Context.GetInstanceData(*this);
 	
-	if (InstanceData.Signal == Smb::Signals::FoundEnemy)
+	if (InstanceData.Signal == Smb::Signals::FoundEnemy || InstanceData.Signal == Smb::Signals::ClosestEnemyChanged)
 	{
 		if (NearEnemiesFragment.ClosestEnemies.Num() <= 0)
 		{
@@ -765,7 +811,7 @@ EStateTreeRunStatus FListenEnemy::Tick(FStateTreeExecutionContext& Context, cons
 	
 	FListenEnemyInstanceData& InstanceData = Context.GetInstanceData(*this);
 	
-	if (InstanceData.Signal == Smb::Signals::FoundEnemy)
+	if (InstanceData.Signal == Smb::Signals::FoundEnemy || InstanceData.Signal == Smb::Signals::ClosestEnemyChanged)
 	{
 		if (NearEnemiesFragment.ClosestEnemies.Num() <= 0)
 		{
@@ -823,7 +869,7 @@ EStateTreeRunStatus FListenerTask::Tick(FStateTreeExecutionContext& Context, con
 	if (InstanceData.Signal == Smb::Signals::MoveTargetChanged)
 	{
 		//UE_LOG(LogTemp, Display, TEXT("FListenerTask::Tick, MoveTargetChanged"));
-		FLocationDataFragment* DataFragment = MassStateTreeContext.GetEntityManager().GetFragmentDataPtr<FLocationDataFragment>(MassStateTreeContext.GetEntity());
+		FLocationTargetFragment* DataFragment = MassStateTreeContext.GetEntityManager().GetFragmentDataPtr<FLocationTargetFragment>(MassStateTreeContext.GetEntity());
 		if (DataFragment)
 		{
 			if (DataFragment->bNewLocation)
@@ -1012,6 +1058,7 @@ FNewWalkTarget::FNewWalkTarget()
 bool FNewWalkTarget::Link(FStateTreeLinker& Linker)
 {
 	Linker.LinkExternalData(LocationDataFragHandle);
+	Linker.LinkExternalData(LocationTargetFragHandle);
 	Linker.LinkExternalData(TransformFragmentHandle);
 	Linker.LinkExternalData(SmbSubsystemHandle);
 	return true;
@@ -1020,46 +1067,42 @@ bool FNewWalkTarget::Link(FStateTreeLinker& Linker)
 
 void FNewWalkTarget::GetDependencies(UE::MassBehavior::FStateTreeDependencyBuilder& Builder) const
 {
-	Builder.AddReadWrite(LocationDataFragHandle);
+	Builder.AddReadOnly(LocationDataFragHandle);
+	Builder.AddReadWrite(LocationTargetFragHandle);
 	Builder.AddReadWrite(TransformFragmentHandle);
-	Builder.AddReadOnly(SmbSubsystemHandle);
+	Builder.AddReadWrite(SmbSubsystemHandle);
 }
 
 EStateTreeRunStatus FNewWalkTarget::EnterState(FStateTreeExecutionContext& Context, const FStateTreeTransitionResult& Transition) const
 {
-	FLocationDataFragment& LocationDataFragment = Context.GetExternalData(LocationDataFragHandle);
-	FVector NewLocation = LocationDataFragment.WalkToLocation;
+	const FLocationDataFragment& LocationDataFragment = Context.GetExternalData(LocationDataFragHandle);
+	FLocationTargetFragment& LocationTargetFragment = Context.GetExternalData(LocationTargetFragHandle);
+	FVector NewLocation = LocationTargetFragment.WalkToLocation;
 
 	FNewNavTargetInstanceData InstanceData = Context.GetInstanceData(*this);
 	
-
-	if (UNavigationSystemV1* NavSys = FNavigationSystem::GetCurrent<UNavigationSystemV1>(Context.GetWorld()))
+	// Projected at the end of the frame, the entity heads for the raw point until the subsystem moves the target onto the navmesh
+	const FMassStateTreeExecutionContext& MassStateTreeContext = static_cast<FMassStateTreeExecutionContext&>(Context);
+	USmbSubsystem& SmbSubsystem = Context.GetExternalData(SmbSubsystemHandle);
+	FSmbNavProjection Projection;
+	Projection.Owner = MassStateTreeContext.GetEntity();
+	Projection.Purpose = ESmbNavProjectionPurpose::WalkTarget;
+	Projection.Point = NewLocation;
+	Projection.Extent = FVector(InstanceData.RadiusNear, InstanceData.RadiusNear, 2500.0f);
+	// Failed fallback
+	if (LocationDataFragment.OldLocation.IsNearlyZero())
 	{
-		FNavLocation NavLocation;
-		if (NavSys->ProjectPointToNavigation(NewLocation, NavLocation, FVector(InstanceData.RadiusNear, InstanceData.RadiusNear, 2500.0f)))
-		{
-			LocationDataFragment.WalkToLocation = NavLocation.Location;
-		}
-		else // Failed fallback
-		{
-			if (LocationDataFragment.OldLocation.IsNearlyZero())
-			{
-				FTransformFragment& TransformFragment = Context.GetExternalData(TransformFragmentHandle);
-				LocationDataFragment.WalkToLocation = TransformFragment.GetTransform().GetLocation();
-			} else
-			{
-				LocationDataFragment.WalkToLocation = LocationDataFragment.OldLocation;	
-			}
-		}
-	}
-	else
+		FTransformFragment& TransformFragment = Context.GetExternalData(TransformFragmentHandle);
+		Projection.FailLocation = TransformFragment.GetTransform().GetLocation();
+	} else
 	{
-		LocationDataFragment.WalkToLocation = LocationDataFragment.OldLocation;
+		Projection.FailLocation = LocationDataFragment.OldLocation;
 	}
+	SmbSubsystem.QueueNavProjection(Projection);
 
 	FMassTargetLocation WalkToTarget = FMassTargetLocation();
 	WalkToTarget.EndOfPathIntent = EMassMovementAction::Stand;
-	WalkToTarget.EndOfPathPosition = LocationDataFragment.WalkToLocation;
+	WalkToTarget.EndOfPathPosition = LocationTargetFragment.WalkToLocation;
 	InstanceData.WalkToTarget = WalkToTarget;
 
 	return EStateTreeRunStatus::Succeeded;
@@ -0,0 +1,91 @@
+﻿// Copyright © 2025 Land Chaunax, All rights reserved.
+
+
+#include "SmbTraceBatch.h"
+#include "Async/ParallelFor.h"
+#include "Misc/ScopeLock.h"
+#include "Engine/World.h"
+
+
+void FSmbTraceBatch::Submit(TArray<FSmbGroundTrace>& Traces)
+{
+	if (Traces.Num() == 0) return;
+	FScopeLock Lock(&PendingLock);
+	Pending.Append(Traces);
+	Traces.Reset();
+}
+
+void FSmbTraceBatch::Launch(UWorld& World, ECollisionChannel Channel)
+{
+	check(!bInFlight);
+	{
+		FScopeLock Lock(&PendingLock);
+		Swap(InFlight, Pending);
+		Pending.Reset();
+	}
+	bInFlight = true;
+	if (InFlight.Num() == 0) return;
+
+	// Scene queries take the physics read lock themselves, so the batch may run on while the next frame starts. Reset waits for it
+	// when the subsystem goes away, it never outlives the world
+	InFlightTask = UE::Tasks::Launch(UE_SOURCE_LOCATION, [this, WorldPtr = &World, Channel]()
+	{
+		TArrayView<FSmbGroundTrace> Traces = InFlight;
+		ParallelFor(TEXT("SmbGroundTraces"), Traces.Num(), 32, [Traces, WorldPtr, Channel](int32 Index)
+		{
+			FSmbGroundTrace& Trace = Traces[Index];
+			FHitResult Hit;
+			Trace.bHit = WorldPtr->LineTraceSingleByChannel(Hit, Trace.Start, Trace.End, Channel);
+			Trace.ImpactPoint = Trace.bHit ? FVector(Hit.ImpactPoint) : Trace.End;
+		});
+	});
+}
+
+bool FSmbTraceBatch::Complete()
+{
+	if (!bInFlight) return true;
+	if (!InFlightTask.IsCompleted()) return false;
+	InFlightTask = UE::Tasks::FTask();
+	bInFlight = false;
+
+	for (const FSmbGroundTrace& Result : Results)
+	{
+		ResultOfEntity[Result.Owner.Index] = INDEX_NONE;
+	}
+	// The old results are reused for the next batch in flight
+	Swap(Results, InFlight);
+	InFlight.Reset();
+
+	for (int32 Index = 0; Index < Results.Num(); ++Index)
+	{
+		const FSmbGroundTrace& Result = Results[Index];
+		if (Result.Owner.Index >= ResultOfEntity.Num())
+		{
+			const int32 OldNum = ResultOfEntity.Num();
+			ResultOfEntity.SetNumUninitialized(Result.Owner.Index+1);
+			for (int32 i = OldNum; i < ResultOfEntity.Num(); ++i) ResultOfEntity[i] = INDEX_NONE;
+		}
+		ResultOfEntity[Result.Owner.Index] = Index;
+	}
+	return true;
+}
+
+const FSmbGroundTrace* FSmbTraceBatch::Find(FMassEntityHandle Owner) const
+{
+	if (!ResultOfEntity.IsValidIndex(Owner.Index)) return nullptr;
+	const int32 Index = ResultOfEntity[Owner.Index];
+	if (Index == INDEX_NONE || Results[Index].Owner != Owner) return nullptr;
+	return &Results[Index];
+}
+
+void FSmbTraceBatch::Reset()
+{
+	InFlightTask.Wait();
+	InFlightTask = UE::Tasks::FTask();
+	bInFlight = false;
+	FScopeLock Lock(&PendingLock);
+	Pending.Empty();
+	InFlight.Empty();
+	Results.Empty();
+	ResultOfEntity.Empty();
+}
@@ -24,6 +24,8 @@ void USmbAnimTrait::BuildTemplate(FMassEntityTemplateBuildContext& BuildContext,
 	
 	FAnimationFragment& AnimRef = BuildContext.AddFragment_GetRef<FAnimationFragment>();
 	AnimRef = InAnimationFragment.GetValidated();
+	const FConstSharedStruct& SharedAnimationParams = MassEntityManager.GetOrCreateConstSharedFragment(InAnimationParams.GetValidated());
+	BuildContext.AddConstSharedFragment(SharedAnimationParams);
 
 	BuildContext.RequireFragment<FMassActorFragment>();
 	const FVertexAnimations VertexFrag = InVertexFrag.GetValidated();
@@ -31,6 +33,24 @@ void USmbAnimTrait::BuildTemplate(FMassEntityTemplateBuildContext& BuildContext,
 	BuildContext.AddSharedFragment(SharedVertexFrag);
 }
 
+void USmbAnimTrait::PostLoad()
+{
+	Super::PostLoad();
+
+#if WITH_EDITORONLY_DATA
+	// Older assets kept the animation tunables in the fragment, they are moved over once and saved with the params from then on
+	auto MoveDeprecated = [](float& Deprecated, float& Param)
+	{
+		if (Deprecated == FAnimationFragment::UnsetDeprecated) return;
+		Param = Deprecated;
+		Deprecated = FAnimationFragment::UnsetDeprecated;
+	};
+	MoveDeprecated(InAnimationFragment.AnimationUnitScale_DEPRECATED, InAnimationParams.AnimationUnitScale);
+	MoveDeprecated(InAnimationFragment.BlendSpeed_DEPRECATED, InAnimationParams.BlendSpeed);
+	MoveDeprecated(InAnimationFragment.AnimationSpeed_DEPRECATED, InAnimationParams.AnimationSpeed);
+#endif
+}
+
 void USmbDefenceTrait::BuildTemplate(FMassEntityTemplateBuildContext& BuildContext, const UWorld& World) const
 {
 	FMassEntityManager& MassEntityManager = UE::Mass::Utils::GetEntityManagerChecked(World);
@@ -47,11 +67,17 @@ void USmbDefenceTrait::BuildTemplate(FMassEntityTemplateBuildContext& BuildConte
 
 void USmbStandardAttackTrait::BuildTemplate(FMassEntityTemplateBuildContext& BuildContext, const UWorld& World) const
 {
+	FMassEntityManager& MassEntityManager = UE::Mass::Utils::GetEntityManagerChecked(World);
+
 	FAttackFragment& AttackRef = BuildContext.AddFragment_GetRef<FAttackFragment>();
 	AttackRef = InAttackFragment.GetValidated();
 
-	FNearEnemiesFragment& NearEnemiesFragment = BuildContext.AddFragment_GetRef<FNearEnemiesFragment>();
-	NearEnemiesFragment = InNearEnemiesFragment.GetValidated();
+	const FNearEnemiesParams NearEnemiesParams = InNearEnemiesParams.GetValidated();
+	const FConstSharedStruct& SharedNearEnemiesParams = MassEntityManager.GetOrCreateConstSharedFragment(NearEnemiesParams);
+	BuildContext.AddConstSharedFragment(SharedNearEnemiesParams);
+	// The first check is staggered per entity by UStaggerEnemyCheckProcessor, a template value would be shared by the whole config
+	BuildContext.AddFragment<FNearEnemiesFragment>();
+	BuildContext.AddChunkFragment<FSmbEnemyCheckChunkFragment>();
 }
 
 void USmbExistingTrait::BuildTemplate(FMassEntityTemplateBuildContext& BuildContext, const UWorld& World) const
@@ -62,14 +88,43 @@ void USmbExistingTrait::BuildTemplate(FMassEntityTemplateBuildContext& BuildCont
 
 	BuildContext.AddFragment<FStateFragment>();
 
-	FCollisionDataFragment& ColRef = BuildContext.AddFragment_GetRef<FCollisionDataFragment>();
-	ColRef = InCollisionFrag.GetValidated();
-
-	FLocationDataFragment& LocationRef = BuildContext.AddFragment_GetRef<FLocationDataFragment>();
-	LocationRef = InDataFragment.GetValidated();
+	FMassEntityManager& MassEntityManager = UE::Mass::Utils::GetEntityManagerChecked(World);
 
-	FHeightFragment& HeightRef = BuildContext.AddFragment_GetRef<FHeightFragment>();
-	HeightRef = InHeightFrag.GetValidated();
+	BuildContext.AddFragment<FCollisionDataFragment>();
+	const FConstSharedStruct& SharedCollisionParams = MassEntityManager.GetOrCreateConstSharedFragment(InCollisionParams.GetValidated());
+	BuildContext.AddConstSharedFragment(SharedCollisionParams);
+	switch (CollisionCapacity)
+	{
+	case ESmbCollisionCapacity::Two:
+		BuildContext.AddFragment<FCollisionNeighbors2Fragment>();
+		break;
+	case ESmbCollisionCapacity::Eight:
+		BuildContext.AddFragment<FCollisionNeighbors8Fragment>();
+		break;
+	case ESmbCollisionCapacity::Sixteen:
+		BuildContext.AddFragment<FCollisionNeighbors16Fragment>();
+		break;
+	default:
+		BuildContext.AddFragment<FCollisionNeighbors4Fragment>();
+		break;
+	}
+
+	// Timers start staggered per entity by UStaggerLocationTimersProcessor
+	const FLocationDataParams LocationParams = InLocationParams.GetValidated();
+	BuildContext.AddFragment<FLocationDataFragment>();
+	BuildContext.AddFragment<FLocationTargetFragment>();
+	const FConstSharedStruct& SharedLocationParams = MassEntityManager.GetOrCreateConstSharedFragment(LocationParams);
+	BuildContext.AddConstSharedFragment(SharedLocationParams);
+	if (LocationParams.bShouldRecheckNav)
+	{
+		BuildContext.AddTag<FSmbNavRecheckTag>();
+	}
+	BuildContext.AddFragment<FSmbFlowFollowerFragment>();
+
+	const FHeightParams HeightParams = InHeightParams.GetValidated();
+	const FConstSharedStruct& SharedHeightParams = MassEntityManager.GetOrCreateConstSharedFragment(HeightParams);
+	BuildContext.AddConstSharedFragment(SharedHeightParams);
+	BuildContext.AddFragment<FHeightFragment>();
 }
 
 void USmbAbilitiesTrait::BuildTemplate(FMassEntityTemplateBuildContext& BuildContext, const UWorld& World) const
@@ -16,7 +16,15 @@ public:
 
 UE_DECLARE_GAMEPLAY_TAG_EXTERN(Scalable_Mass_Behaviour);
 
-#define COLLISION_ARR_SIZE 4
+/** How many neighbours a collision fragment tracks, each picks its own fragment so small units don't pay for the largest */
+UENUM(BlueprintType)
+enum class ESmbCollisionCapacity : uint8
+{
+	Two = 2 UMETA(ToolTip = "Two handles take a quarter of a cache line, for small units in dense swarms"),
+	Four = 4,
+	Eight = 8,
+	Sixteen = 16 UMETA(ToolTip = "For large units that touch many others at once")
+};
 
 UENUM(BlueprintType)
 enum class EProcessable : uint8
@@ -63,6 +71,9 @@ namespace Smb::Signals
 {
 	const FName AttackFinished = FName("AttackFinished");
 	const FName ReceivedDamage = FName("ReceivedDamage");
+	/* Sent when the first enemy shows up, ClosestEnemyChanged and EnemiesLost follow the list after that */
 	const FName FoundEnemy = FName("FoundEnemy");
+	const FName ClosestEnemyChanged = FName("ClosestEnemyChanged");
+	const FName EnemiesLost = FName("EnemiesLost");
 	const FName MoveTargetChanged = FName("MoveTargetChanged");
 }
@@ -0,0 +1,69 @@
+﻿// Copyright © 2025 Land Chaunax, All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include <atomic>
+
+class UWorld;
+
+/*
+ * Direction field towards the destination area of a move order, owned and cached by USmbSubsystem.
+ * Covers a rectangle of the world in square cells, every walkable cell stores which of its eight neighbours is one step
+ * closer to the destination, so all units of the order (and later orders to the same area) share one navmesh walk instead
+ * of projecting and pathing one by one. The navmesh is sampled on the game thread, the field is then built once on a worker
+ * thread and read only afterwards.
+ */
+class SCALABLEMASSBEHAVIOUR_API FSmbFlowField
+{
+public:
+	/* Stored for cells without a way on, the destination area itself, blocked cells and cells the destination can't be reached from */
+	static constexpr uint8 NoDirection = 0xFF;
+
+	FSmbFlowField(const FVector& InGoal, float InGoalRadius, const FBox2D& InBounds, float InCellSize);
+
+	/*
+	 * Game thread. Marks which of the next MaxSamples cells the navmesh reaches, projected through FSmbNavProjectionService::ProjectAll
+	 * while navmesh updates are held back. Large fields are sampled over several frames, returns how many cells were projected.
+	 */
+	int32 SampleWalkable(UWorld& World, float VerticalExtent, int32 MaxSamples);
+	bool IsSampled() const { return NextSampleCell >= SizeX*SizeY; }
+
+	/*
+	 * Integrates the walking cost out from every walkable cell of the destination area and stores the cheapest neighbour per cell.
+	 * Only reads the sampled cells and never the navmesh, so it runs on a worker thread once IsSampled. Nothing reads the field before IsReady.
+	 * Stops early without becoming ready once Cancel was called.
+	 */
+	void Build();
+	bool IsReady() const { return bReady.load(std::memory_order_acquire); }
+	/* Any thread, a running Build returns at its next step */
+	void Cancel() { bCancelled.store(true, std::memory_order_relaxed); }
+
+	/* Flat unit direction to walk at Location, false outside the field and in cells storing NoDirection */
+	bool SampleDirection(const FVector& Location, FVector2D& OutDirection) const;
+	/* True when an order from Bounds towards the same destination area can walk this field instead of building its own */
+	bool CanServe(const FVector& InGoal, float InGoalRadius, const FBox2D& InBounds) const;
+
+	float GetCellSize() const { return CellSize; }
+
+	/* World time of the build request and of the last order reusing the field, the subsystem drops old and unused fields by them */
+	double CreationTime = 0.0;
+	double LastUsedTime = 0.0;
+
+private:
+	int32 CellIndexOf(const FVector2D& Location) const;
+
+	FVector Goal = FVector::ZeroVector;
+	float GoalRadius = 0.f;
+	FVector2D Origin = FVector2D::ZeroVector;
+	float CellSize = 100.f;
+	int32 SizeX = 0;
+	int32 SizeY = 0;
+	/* Per cell, row major from Origin. Filled by SampleWalkable and emptied once built */
+	TArray<bool> Walkable;
+	int32 NextSampleCell = 0;
+	/* Neighbour index per cell, row major from Origin */
+	TArray<uint8> Directions;
+	std::atomic<bool> bReady = false;
+	std::atomic<bool> bCancelled = false;
+};
@@ -14,12 +14,27 @@
 // Needed for templates
 #include "MassEntityTypes.h"
 #include "Components/InstancedStaticMeshComponent.h"
+#include "UObject/PropertyTag.h"
 
 #include "SmbFragments.generated.h"
 
 class UNiagaraSystem;
 struct FMassEntityHandle;
-struct FTraceHandle;
+
+namespace Smb
+{
+	/*
+	 * Loads trait settings saved under the fragment type they used to live in. The old struct's fields are read by name,
+	 * the ones Target doesn't have are skipped. False when the tag is of any other type.
+	 */
+	template<typename T>
+	bool SerializeFromLegacyStruct(T& Target, const FPropertyTag& Tag, FStructuredArchive::FSlot Slot, const FName LegacyStructName)
+	{
+		if (!Tag.GetType().IsStruct(LegacyStructName)) return false;
+		T::StaticStruct()->SerializeItem(Slot, &Target, nullptr);
+		return true;
+	}
+}
 
 USTRUCT()
 struct FResourceFragment : public FMassFragment
@@ -65,9 +80,7 @@ struct FAnimationFragment : public FMassFragment
 	FAnimationFragment GetValidated() const
 	{
 		FAnimationFragment Copy = *this;
-		Copy.AnimationUnitScale = FMath::Max(Copy.AnimationUnitScale, KINDA_SMALL_NUMBER);
 		Copy.AnimOffsetTime = FMath::Max(Copy.AnimOffsetTime, KINDA_SMALL_NUMBER);;
-		Copy.AnimationSpeed = FMath::Max(Copy.AnimationSpeed, KINDA_SMALL_NUMBER);
 
 		return Copy;
 	}
@@ -79,9 +92,6 @@ struct FAnimationFragment : public FMassFragment
 	UPROPERTY()
 	EAnimationState PreviousState = EAnimationState::Idle;
 	
-	/* To scale Vertex Animation. Should be the same scale as unit Mesh. */
-	UPROPERTY(EditAnywhere, Category = "Smb")
-	float AnimationUnitScale = 1.f;
 	/* Offset Timing i.e., changes timing so ISM material instance starts on the correct time */
 	UPROPERTY(EditAnywhere, Category = "Smb")
 	float AnimOffsetTime = 0.f;
@@ -91,10 +101,6 @@ struct FAnimationFragment : public FMassFragment
 
 	UPROPERTY()
 	float LerpAlpha = 0.f;
-
-	/* How quickly the vertex animation should blend between animations */
-	UPROPERTY(EditAnywhere, Category = "Smb")
-	float BlendSpeed = 5.f;
 	
 	UPROPERTY()
 	FName AnimationName = FName("None");
@@ -115,6 +121,40 @@ struct FAnimationFragment : public FMassFragment
 	UPROPERTY()
 	float PrevEnd = 0.f;
 
+#if WITH_EDITORONLY_DATA
+	/* Moved to FAnimationParams, only loaded from older assets for USmbAnimTrait::PostLoad to carry over. UnsetDeprecated otherwise */
+	static constexpr float UnsetDeprecated = -1.f;
+	UPROPERTY()
+	float AnimationUnitScale_DEPRECATED = UnsetDeprecated;
+	UPROPERTY()
+	float BlendSpeed_DEPRECATED = UnsetDeprecated;
+	UPROPERTY()
+	float AnimationSpeed_DEPRECATED = UnsetDeprecated;
+#endif
+};
+
+/* Vertex animation tunables, shared by every entity of an archetype */
+USTRUCT()
+struct FAnimationParams : public FMassConstSharedFragment
+{
+	GENERATED_BODY()
+
+	FAnimationParams GetValidated() const
+	{
+		FAnimationParams Copy = *this;
+		Copy.AnimationUnitScale = FMath::Max(Copy.AnimationUnitScale, KINDA_SMALL_NUMBER);
+		Copy.AnimationSpeed = FMath::Max(Copy.AnimationSpeed, KINDA_SMALL_NUMBER);
+		return Copy;
+	}
+
+	/* To scale Vertex Animation. Should be the same scale as unit Mesh. */
+	UPROPERTY(EditAnywhere, Category = "Smb")
+	float AnimationUnitScale = 1.f;
+
+	/* How quickly the vertex animation should blend between animations */
+	UPROPERTY(EditAnywhere, Category = "Smb")
+	float BlendSpeed = 5.f;
+
 	/* How quick to play the vertex animation, 1 is 100% speed*/
 	UPROPERTY(EditAnywhere, Category = "Smb")
 	float AnimationSpeed = 1.f;
@@ -387,27 +427,56 @@ struct FAliveTag : public FMassTag
 	GENERATED_BODY()
 };
 
+/* Entities that verify their height with line traces, only these go through UNavRecheckProcessor */
+USTRUCT()
+struct FSmbNavRecheckTag : public FMassTag
+{
+	GENERATED_BODY()
+};
 
+/*
+ * Settled entities, skipped by registration, collision and nav rechecks while they stay in the grid where they fell asleep.
+ * Removed again by being pushed, damaged, moved or finding an enemy.
+ */
 USTRUCT()
-struct FLocationDataFragment : public FMassFragment
+struct FSmbSleepingTag : public FMassTag
 {
 	GENERATED_BODY()
+};
 
-	FLocationDataFragment() = default;
 
-	FLocationDataFragment GetValidated() const
-	{
-		FLocationDataFragment Copy = *this;
-		Copy.BaseRefresh = FMath::Max(Copy.BaseRefresh, 0.f);
-		Copy.TimeSince = FMath::Max(FMath::FRandRange(0.f,Copy.BaseRefresh), 0.f);
+/* Grid refresh state, touched by URegisterProcessor every frame. Targets live in FLocationTargetFragment, tunables in FLocationDataParams */
+USTRUCT()
+struct FLocationDataFragment : public FMassFragment
+{
+	GENERATED_BODY()
 
-		return Copy;
-	}
+	FLocationDataFragment() = default;
 
 	/* Old Entity Location In Grid */
 	UPROPERTY()
 	FVector OldLocation = FVector::ZeroVector;
 
+	/* Time Since Last */
+	UPROPERTY()
+	float TimeSince = 9999.f;
+
+	UPROPERTY()
+	float ExponentialMove = 0.f;
+
+	UPROPERTY()
+	int32 DidNotMoveStreak = 0;
+
+	UPROPERTY()
+	int32 StillRefreshes = 0;
+};
+
+/* Where the entity is headed, written by orders, tasks and replication and read when they or a grid refresh need it */
+USTRUCT()
+struct FLocationTargetFragment : public FMassFragment
+{
+	GENERATED_BODY()
+
 	/* Location to walk towards (Changes during runtime) */
 	UPROPERTY()
 	FVector WalkToLocation = FVector::ZeroVector;
@@ -419,42 +488,81 @@ struct FLocationDataFragment : public FMassFragment
 	UPROPERTY()
 	FVector PrevWalkToLocationBeforeAttack = FVector::ZeroVector;
 
+	/* How trace checks distance and time reduction multipliers */
+	UPROPERTY()
+	float TraceDistMulti = 1.f;
+
 	UPROPERTY()
 	bool bIsAttackLocation = false;
 
-	/* Time Since Last */
 	UPROPERTY()
-	float TimeSince = 9999.f;
+	bool bNewLocation = false;
+
+	UPROPERTY()
+	bool bIsFirstMove = true;
+};
+
+/* Grid refresh tunables, shared by every entity of an archetype */
+USTRUCT()
+struct FLocationDataParams : public FMassConstSharedFragment
+{
+	GENERATED_BODY()
+
+	FLocationDataParams GetValidated() const
+	{
+		FLocationDataParams Copy = *this;
+		Copy.BaseRefresh = FMath::Max(Copy.BaseRefresh, 0.f);
+		return Copy;
+	}
+
+	/* Traits saved these as part of FLocationDataFragment */
+	bool SerializeFromMismatchedTag(const FPropertyTag& Tag, FStructuredArchive::FSlot Slot)
+	{
+		return Smb::SerializeFromLegacyStruct(*this, Tag, Slot, FName("LocationDataFragment"));
+	}
 
 	/* How frequently should entity update position in the grid (Base only larger if lower LOD) */
 	UPROPERTY(EditAnywhere, Category = "Smb")
 	float BaseRefresh = 1.f;
 
-	/* How frequently should entity update position in the grid (Base only larger if lower LOD) */
-	UPROPERTY()
-	bool bTraceResultIn = false;
+	/* If the entity should keep rechecking the NavMesh to interpolate height (one line trace per refresh) */ 
+	UPROPERTY(EditAnywhere, Category = "Smb")
+	bool bShouldRecheckNav = false;
 
-	/* How trace checks distance and time reduction multipliers */
-	UPROPERTY()
-	float TraceDistMulti = 1.f;
+	/* If the entity may stop registering and colliding while it stands still, it wakes up when disturbed */
+	UPROPERTY(EditAnywhere, Category = "Smb")
+	bool bCanSleep = true;
 
-	FTraceHandle HitResultAsync;
-	
-	UPROPERTY()
-	bool bNewLocation = false;
+	/* Still grid refreshes in a row, with ExponentialMove under SleepMoveThreshold, before the entity falls asleep */
+	UPROPERTY(EditAnywhere, Category = "Smb")
+	int32 RefreshesBeforeSleep = 4;
 
-	/* If the entity should keep rechecking the NavMesh to interpolate height (more heavy on CPU gamethread) */ 
 	UPROPERTY(EditAnywhere, Category = "Smb")
-	bool bShouldRecheckNav = false;
+	float SleepMoveThreshold = 10.f;
+};
 
-	UPROPERTY()
-	float ExponentialMove = 0.f;
+template<>
+struct TStructOpsTypeTraits<FLocationDataParams> : public TStructOpsTypeTraitsBase2<FLocationDataParams>
+{
+	enum
+	{
+		WithStructuredSerializeFromMismatchedTag = true,
+	};
+};
 
+/* Flow field of the last move order the entity got, see USmbSubsystem::RequestFlowField */
+USTRUCT()
+struct FSmbFlowFollowerFragment : public FMassFragment
+{
+	GENERATED_BODY()
+
+	/* INDEX_NONE when the entity isn't following a field */
 	UPROPERTY()
-	int32 DidNotMoveStreak = 0;
+	int32 FlowFieldId = INDEX_NONE;
 
+	/* Spot the order gave the entity, the field is only followed while the move target still points there */
 	UPROPERTY()
-	bool bIsFirstMove = true;
+	FVector Destination = FVector::ZeroVector;
 };
 
 USTRUCT()
@@ -464,17 +572,6 @@ struct FHeightFragment : public FMassFragment
 
 	FHeightFragment() = default;
 
-	FHeightFragment GetValidated() const
-	{
-		FHeightFragment Copy = *this;
-		Copy.HeightInterpolationSpeed = FMath::Max(Copy.HeightInterpolationSpeed, 10.f);
-		Copy.BaseRefreshPeriod = FMath::Max(Copy.BaseRefreshPeriod, 0.01f);
-		Copy.TimeSinceRefresh = FMath::Max(FMath::FRandRange(0,Copy.BaseRefreshPeriod), 0.f);
-		Copy.DistanceAwayToCheckNavMulti = FMath::Max(Copy.DistanceAwayToCheckNavMulti, 0.5f);
-		
-		return Copy;
-	}
-	
 	UPROPERTY()
 	float TargetHeight = -999999999.f;
 
@@ -483,6 +580,29 @@ struct FHeightFragment : public FMassFragment
 
 	UPROPERTY()
 	float TimeSinceRefresh = 0.f;
+};
+
+/* Ground following tunables, shared by every entity of an archetype */
+USTRUCT()
+struct FHeightParams : public FMassConstSharedFragment
+{
+	GENERATED_BODY()
+
+	FHeightParams GetValidated() const
+	{
+		FHeightParams Copy = *this;
+		Copy.HeightInterpolationSpeed = FMath::Max(Copy.HeightInterpolationSpeed, 10.f);
+		Copy.BaseRefreshPeriod = FMath::Max(Copy.BaseRefreshPeriod, 0.01f);
+		Copy.DistanceAwayToCheckNavMulti = FMath::Max(Copy.DistanceAwayToCheckNavMulti, 0.5f);
+		
+		return Copy;
+	}
+
+	/* Traits saved these as part of FHeightFragment */
+	bool SerializeFromMismatchedTag(const FPropertyTag& Tag, FStructuredArchive::FSlot Slot)
+	{
+		return Smb::SerializeFromLegacyStruct(*this, Tag, Slot, FName("HeightFragment"));
+	}
 
 	/* How quickly the unit moves up or down when walking on a slope */
 	UPROPERTY(EditAnywhere, Category = "Smb")
@@ -499,6 +619,15 @@ struct FHeightFragment : public FMassFragment
 	float DistanceAwayToCheckNavMulti = 3.f;
 };
 
+template<>
+struct TStructOpsTypeTraits<FHeightParams> : public TStructOpsTypeTraitsBase2<FHeightParams>
+{
+	enum
+	{
+		WithStructuredSerializeFromMismatchedTag = true,
+	};
+};
+
 USTRUCT()
 struct FCollisionDataFragment : public FMassFragment
 {
@@ -506,34 +635,121 @@ struct FCollisionDataFragment : public FMassFragment
 
 	FCollisionDataFragment() = default;
 
-	FCollisionDataFragment GetValidated() const
+	UPROPERTY()
+	float TimeSinceLastCheck = 0.f;
+
+	//UPROPERTY()
+	//FMassEntityHandle ClosestEntity;
+
+	/* Decaying sum of the collision pushes received, an entity still being pushed around doesn't fall asleep */
+	UPROPERTY()
+	float RecentPush = 0.f;
+};
+
+/* Collision tunables, shared by every entity of an archetype. Neighbours read each other's CollisionMass from here */
+USTRUCT()
+struct FCollisionParams : public FMassConstSharedFragment
+{
+	GENERATED_BODY()
+
+	FCollisionParams GetValidated() const
 	{
-		FCollisionDataFragment Copy = *this;
+		FCollisionParams Copy = *this;
 		Copy.CheckDelay = FMath::Max(Copy.CheckDelay, 0.f);
-		Copy.TimeSinceLastCheck = FMath::Max(Copy.TimeSinceLastCheck, 0.f);
 		Copy.MaxEntitiesToCheck = FMath::Max(Copy.MaxEntitiesToCheck, 1);
+		Copy.CollisionMass = FMath::Max(Copy.CollisionMass, KINDA_SMALL_NUMBER);
 
 		return Copy;
 	}
 
+	/* Traits saved these as part of FCollisionDataFragment */
+	bool SerializeFromMismatchedTag(const FPropertyTag& Tag, FStructuredArchive::FSlot Slot)
+	{
+		return Smb::SerializeFromLegacyStruct(*this, Tag, Slot, FName("CollisionDataFragment"));
+	}
+
 	UPROPERTY(EditAnywhere, Category = "Smb")
 	float CheckDelay = 1.f;
-	UPROPERTY()
-	float TimeSinceLastCheck = 0.f;
 
-	/* CURRENTLY NOT FUNCTIONAL */
+	/* How many of the closest entities are tracked, capped by the collision capacity of the trait */
 	UPROPERTY(EditAnywhere, Category = "Smb")
 	int32 MaxEntitiesToCheck = 5;
 
-	TStaticArray<FMassEntityHandle, COLLISION_ARR_SIZE> ClosestEntities;
-	//UPROPERTY()
-	//FMassEntityHandle ClosestEntity;
-
 	/* Weight to collide with */
 	UPROPERTY(EditAnywhere, Category = "Smb")
 	float CollisionMass = 10.f;
 };
 
+template<>
+struct TStructOpsTypeTraits<FCollisionParams> : public TStructOpsTypeTraitsBase2<FCollisionParams>
+{
+	enum
+	{
+		WithStructuredSerializeFromMismatchedTag = true,
+	};
+};
+
+/* Closest entities found by the last collision check and how they looked at that moment.
+ * Between checks their locations are extrapolated from the snapshot so no other entity has to be read. */
+template<int32 InCapacity>
+struct TSmbCollisionNeighbors
+{
+	static constexpr int32 Capacity = InCapacity;
+
+	TStaticArray<FMassEntityHandle, Capacity> ClosestEntities;
+	TStaticArray<FVector3f, Capacity> Locations;
+	TStaticArray<FVector3f, Capacity> Velocities;
+	TStaticArray<float, Capacity> Radii;
+	TStaticArray<float, Capacity> Masses;
+
+	/* Bit per neighbour, set when this side resolves the pair so it isn't pushed twice */
+	uint32 OwnedMask = 0;
+
+	/* Bit per owned neighbour that may also resolve the pair from its side, each side then applies half the push */
+	uint32 SharedMask = 0;
+
+	/* Seconds since the snapshot was taken */
+	float Age = 0.f;
+
+	FVector GetPredictedLocation(int32 Index) const
+	{
+		return FVector(Locations[Index] + Velocities[Index]*Age);
+	}
+};
+
+/* One fragment per ESmbCollisionCapacity */
+USTRUCT()
+struct FCollisionNeighbors2Fragment : public FMassFragment
+{
+	GENERATED_BODY()
+
+	TSmbCollisionNeighbors<2> Neighbors;
+};
+
+USTRUCT()
+struct FCollisionNeighbors4Fragment : public FMassFragment
+{
+	GENERATED_BODY()
+
+	TSmbCollisionNeighbors<4> Neighbors;
+};
+
+USTRUCT()
+struct FCollisionNeighbors8Fragment : public FMassFragment
+{
+	GENERATED_BODY()
+
+	TSmbCollisionNeighbors<8> Neighbors;
+};
+
+USTRUCT()
+struct FCollisionNeighbors16Fragment : public FMassFragment
+{
+	GENERATED_BODY()
+
+	TSmbCollisionNeighbors<16> Neighbors;
+};
+
 USTRUCT()
 struct FDeathPhysicsSharedFragment : public FMassSharedFragment
 {
@@ -632,16 +848,38 @@ public:
 
 	FNearEnemiesFragment() = default;
 
-	FNearEnemiesFragment GetValidated() const
+	/* Most enemies one entity can be aware of, the list is stored inline in the fragment */
+	static constexpr int32 MaxTrackedEnemies = 16;
+
+	/* Close enemies, nearest first */
+	TArray<FMassEntityHandle, TFixedAllocator<MaxTrackedEnemies>> ClosestEnemies;
+
+	/* Timer */
+	UPROPERTY()
+	float TimeSinceLastCheck = 0.5f;
+};
+
+/* Enemy search tunables, shared by every entity of an archetype */
+USTRUCT()
+struct FNearEnemiesParams : public FMassConstSharedFragment
+{
+	GENERATED_BODY()
+
+	FNearEnemiesParams GetValidated() const
 	{
-		FNearEnemiesFragment Copy = *this;
+		FNearEnemiesParams Copy = *this;
 		Copy.CheckPeriod = FMath::Max(Copy.CheckPeriod, 0.02f);
-		Copy.TimeSinceLastCheck = rand()*(1.f/CheckPeriod);
-		Copy.AmountOfEnemies = FMath::Max(Copy.AmountOfEnemies, 1);
+		Copy.AmountOfEnemies = FMath::Clamp<int8>(Copy.AmountOfEnemies, 1, FNearEnemiesFragment::MaxTrackedEnemies);
 		
 		return Copy;
 	}
 
+	/* Traits saved these as part of FNearEnemiesFragment */
+	bool SerializeFromMismatchedTag(const FPropertyTag& Tag, FStructuredArchive::FSlot Slot)
+	{
+		return Smb::SerializeFromLegacyStruct(*this, Tag, Slot, FName("NearEnemiesFragment"));
+	}
+
 	/* How often to check in seconds min(0.02f) (time multiplied for lower LODS) */
 	UPROPERTY(EditAnywhere, Category = "Smb")
 	float CheckPeriod = 1.5f;
@@ -650,19 +888,33 @@ public:
 	UPROPERTY(EditAnywhere, Category = "Smb")
 	float CheckRadius = 500.f;
 
-	/* Array with information about close enemies */
-	UPROPERTY()
-	TArray<FMassEntityHandle> ClosestEnemies = TArray<FMassEntityHandle>();
-
-	/* Timer */
-	UPROPERTY()
-	float TimeSinceLastCheck = 0.5f;
-
-	/* How many enemies to be aware of max */
+	/* How many enemies to be aware of max (at most MaxTrackedEnemies) */
 	UPROPERTY(EditAnywhere, Category = "Smb")
 	int8 AmountOfEnemies = 5;
 };
 
+template<>
+struct TStructOpsTypeTraits<FNearEnemiesParams> : public TStructOpsTypeTraitsBase2<FNearEnemiesParams>
+{
+	enum
+	{
+		WithStructuredSerializeFromMismatchedTag = true,
+	};
+};
+
+/* Frame slot ULocateEnemy walks this chunk on, so every frame only a slice of the entities is touched */
+USTRUCT()
+struct FSmbEnemyCheckChunkFragment : public FMassChunkFragment
+{
+	GENERATED_BODY()
+
+	/* INDEX_NONE until the chunk is first visited and given the next slot */
+	int32 Slot = INDEX_NONE;
+
+	uint64 LastVisitFrame = 0;
+	double LastVisitTime = 0.0;
+};
+
 #if ENGINE_MAJOR_VERSION==5 && ENGINE_MINOR_VERSION>=7 
 template<>
 struct TMassFragmentTraits<FNearEnemiesFragment>
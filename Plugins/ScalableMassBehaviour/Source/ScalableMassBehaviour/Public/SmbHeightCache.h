@@ -0,0 +1,77 @@
+﻿// Copyright © 2025 Land Chaunax, All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/StaticArray.h"
+#include "HAL/CriticalSection.h"
+
+/* What a height lookup found */
+enum class ESmbHeightSample : uint8
+{
+	/* Every sample around the location is known and on the navmesh */
+	Hit,
+	/* At least one sample was never projected, it can be requested with RequestMissing */
+	Miss,
+	/* A sample around the location has no navmesh under it or the cached ground is on another level, ask the navmesh directly */
+	NoNav,
+};
+
+/*
+ * Ground heights sampled from the navmesh on a regular grid, owned by USmbSubsystem and filled lazily.
+ * Samples are grouped in square tiles that are only created once something asks for a height inside them,
+ * a lookup blends the four samples around a location. Single layered: where levels overlap the samples belong to whichever
+ * level the first request came from, lookups too far from that height report NoNav.
+ * Readers run in parallel during processing, the only writer is Resolve on the game thread.
+ */
+class SCALABLEMASSBEHAVIOUR_API FSmbHeightCache
+{
+public:
+	/* Samples per tile side */
+	static constexpr int32 TileSamples = 16;
+
+	/* Bilinear height at Location, only written on a Hit. MaxHeightDifference is how far from Location.Z the cached ground may be */
+	ESmbHeightSample Sample(const FVector& Location, float MaxHeightDifference, float& OutHeight) const;
+	/* Adds the unknown samples around Location to OutRequests, handed to Submit later */
+	void RequestMissing(const FVector& Location, TArray<FVector>& OutRequests) const;
+
+	/* Thread safe, parallel chunks hand over their requests together */
+	void Submit(TArray<FVector>& Requests);
+	/* Game thread, once per frame. Projects up to MaxSamples requested samples and stores them */
+	void Resolve(UWorld& World, int32 MaxSamples);
+	/* Drops every sample, the navmesh changed */
+	void Invalidate();
+
+	void SetSampleSpacing(float InSpacing);
+	void Reset();
+
+private:
+	enum class EState : uint8
+	{
+		Unknown,
+		Valid,
+		NoNav,
+	};
+
+	struct FTile
+	{
+		TStaticArray<float, TileSamples*TileSamples> Heights;
+		TStaticArray<EState, TileSamples*TileSamples> States;
+	};
+
+	static int32 FloorDiv(int32 Value, int32 Divisor)
+	{
+		return Value >= 0 ? Value/Divisor : (Value-Divisor+1)/Divisor;
+	}
+	FIntPoint ToSample(const FVector& Location) const;
+	EState GetState(const FIntPoint& SampleCoord, float& OutHeight) const;
+
+	float Spacing = 100.f;
+	TArray<FTile> Tiles;
+	TMap<FIntPoint, int32> TileLookup;
+
+	TArray<FVector> Pending;
+	FCriticalSection PendingLock;
+	/* Resolve scratch, kept to avoid reallocating every frame */
+	TArray<FVector> Requested;
+};
@@ -0,0 +1,74 @@
+﻿// Copyright © 2025 Land Chaunax, All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "MassEntityHandle.h"
+#include "SmbSpatialGrid.h"
+
+/* What one team contributes to an influence cell */
+struct FSmbInfluenceTeam
+{
+	int32 Team = FSmbSpatialGrid::NoTeam;
+	/* Alive damageable entities of the team in the cell */
+	int32 Num = 0;
+	/* Summed HP of those entities */
+	float Strength = 0.f;
+};
+
+/*
+ * Low resolution per team map of where the targetable entities are and how much HP they carry, owned by USmbSubsystem.
+ * Every entity contributes its current HP to one cell and remembers which, so a cell change or a damage event is a
+ * subtract and an add instead of a rebuild. Writers are the serial grid flush and the damage functions of the subsystem.
+ * Cell coordinates are up to the owner, the subsystem uses fine grid cells divided by its influence factor.
+ */
+class SCALABLEMASSBEHAVIOUR_API FSmbInfluenceMap
+{
+public:
+	/* Moves the handle's contribution to the cell and replaces its team and strength, zero strength or less takes it off the map */
+	void Set(FMassEntityHandle Handle, const FIntPoint& Cell, int32 Team, float Strength);
+	/* Changes the strength of a handle already on the map without moving it, handles not on the map are ignored */
+	void SetStrength(FMassEntityHandle Handle, float Strength);
+	void Remove(FMassEntityHandle Handle);
+
+	bool Contains(FMassEntityHandle Handle) const;
+	/* Strength the handle currently contributes, zero when it isn't on the map */
+	float GetStrength(FMassEntityHandle Handle) const;
+
+	/* Per team contributions of one cell, empty when nothing targetable is in it. Invalidated by the next write */
+	TConstArrayView<FSmbInfluenceTeam> GetTeamsAt(int32 X, int32 Y) const;
+	/* Summed strength of every team other than InTeam in one cell, entities without a team don't count as enemies */
+	float GetEnemyStrengthAt(int32 X, int32 Y, int32 InTeam) const;
+	/* True when any cell of the square from X-Radius to X+Radius (inclusive), same for Y, holds an enemy of InTeam */
+	bool HasEnemyAround(int32 X, int32 Y, int32 Radius, int32 InTeam) const;
+	/* Cell of that square with the highest enemy strength, false when the square holds no enemy */
+	bool FindStrongestEnemyCell(int32 X, int32 Y, int32 Radius, int32 InTeam, FIntPoint& OutCell, float& OutStrength) const;
+
+	void EmptySelf();
+
+private:
+	struct FCell
+	{
+		TArray<FSmbInfluenceTeam, TInlineAllocator<4>> Teams;
+	};
+
+	/* Current contribution of an entity, indexed by FMassEntityHandle::Index */
+	struct FEntry
+	{
+		int32 SerialNumber = 0;
+		int32 CellIndex = INDEX_NONE;
+		int32 Team = FSmbSpatialGrid::NoTeam;
+		float Strength = 0.f;
+	};
+
+	static bool IsEnemyOf(const FSmbInfluenceTeam& TeamInfluence, int32 InTeam);
+	const FEntry* FindEntry(FMassEntityHandle Handle) const;
+	int32 FindCell(int32 X, int32 Y) const;
+	/* Adds Count entities and Strength for Team, negative values take a contribution back out */
+	void AddToCell(int32 CellIndex, int32 Team, int32 Count, float Strength);
+
+	/* Cells are never removed, an emptied cell just holds no teams */
+	TArray<FCell> Cells;
+	TMap<FIntPoint, int32> CellLookup;
+	TArray<FEntry> Entries;
+};
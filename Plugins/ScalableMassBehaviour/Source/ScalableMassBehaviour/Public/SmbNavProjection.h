@@ -0,0 +1,66 @@
+﻿// Copyright © 2025 Land Chaunax, All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+#include "MassEntityHandle.h"
+
+/* What a projection is for, an entity has at most one result per purpose and frame */
+enum class ESmbNavProjectionPurpose : uint8
+{
+	/* Ground under the entity, USmbSubsystem writes it into the entity's FHeightFragment once resolved */
+	Height,
+	/* End of a walk target, USmbSubsystem moves the target onto the navmesh once resolved */
+	WalkTarget,
+	Num
+};
+
+/* One "closest navmesh point" question and, once resolved, its answer */
+struct FSmbNavProjection
+{
+	FMassEntityHandle Owner;
+	ESmbNavProjectionPurpose Purpose = ESmbNavProjectionPurpose::Height;
+	FVector Point = FVector::ZeroVector;
+	FVector Extent = FVector::ZeroVector;
+	/* Second try when nothing is found within Extent, zero skips it */
+	FVector FallbackExtent = FVector::ZeroVector;
+	/* Location handed back when neither try finds the navmesh */
+	FVector FailLocation = FVector::ZeroVector;
+
+	/* Filled when resolved */
+	FVector Location = FVector::ZeroVector;
+	bool bFound = false;
+	bool bFoundWithFallback = false;
+};
+
+/*
+ * Navmesh projections of one frame, owned by USmbSubsystem. Processors and StateTree tasks queue them from any thread instead of
+ * querying the navmesh themselves, the subsystem resolves the whole frame at once on worker threads and the results are
+ * readable during the next frame.
+ */
+class SCALABLEMASSBEHAVIOUR_API FSmbNavProjectionService
+{
+public:
+	/* Thread safe, parallel chunks hand over their projections together */
+	void Submit(TArray<FSmbNavProjection>& Projections);
+	void Submit(const FSmbNavProjection& Projection);
+
+	/*
+	 * Game thread, once per frame after the processors ran. Projects everything queued since the last call in parallel while
+	 * navmesh updates are held back, then makes those the results GetResults returns until the next call. Later entries of an
+	 * owner and purpose win when applied in order.
+	 */
+	void Resolve(UWorld& World);
+	/* Projects every entry on worker threads with navmesh updates held back, fills Location, bFound and bFoundWithFallback. Game thread only */
+	static void ProjectAll(UWorld& World, TArrayView<FSmbNavProjection> Projections);
+
+	TConstArrayView<FSmbNavProjection> GetResults() const { return Resolved; }
+
+	void Reset();
+
+private:
+	TArray<FSmbNavProjection> Pending;
+	FCriticalSection PendingLock;
+	TArray<FSmbNavProjection> Resolved;
+};
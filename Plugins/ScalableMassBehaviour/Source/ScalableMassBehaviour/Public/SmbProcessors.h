@@ -6,6 +6,8 @@
 #include "MassProcessor.h"
 #include "MassEntityQuery.h"
 #include "MassObserverProcessor.h"
+#include "HAL/CriticalSection.h"
+#include "SmbSpatialGrid.h"
 #include "SmbProcessors.generated.h"
 
 #define SCALE_API SCALABLEMASSBEHAVIOUR_API
@@ -46,6 +48,48 @@ private:
 	FMassEntityQuery EntityQuery;
 };
 
+/* Sleepers skip URegisterProcessor, this brings their grid entry and influence up to date with HP changed from outside the damage functions */
+UCLASS()
+class SCALABLEMASSBEHAVIOUR_API USleeperRefreshProcessor : public UMassProcessor
+{
+	GENERATED_BODY()
+
+public:
+	USleeperRefreshProcessor();
+
+protected:
+	virtual void ConfigureQueries(const TSharedRef<FMassEntityManager>& EntityManager) override;
+
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+	
+private:
+	FMassEntityQuery EntityQuery;
+
+	/* Seconds between two passes over all sleepers */
+	UPROPERTY(EditAnywhere, Category = "Smb")
+	float RefreshPeriod = 1.f;
+
+	float TimeSinceRefresh = 0.f;
+};
+
+/* Applies and queues the ground traces of FSmbNavRecheckTag entities, the subsystem traces each frame's batch on worker threads until the next one */
+UCLASS()
+class SCALABLEMASSBEHAVIOUR_API UNavRecheckProcessor : public UMassProcessor
+{
+	GENERATED_BODY()
+
+public:
+	UNavRecheckProcessor();
+
+protected:
+	virtual void ConfigureQueries(const TSharedRef<FMassEntityManager>& EntityManager) override;
+
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+	
+private:
+	FMassEntityQuery EntityQuery;
+};
+
 
 UCLASS()
 class SCALABLEMASSBEHAVIOUR_API UCollisionProcessor : public UMassProcessor
@@ -62,6 +106,20 @@ protected:
 	
 private:
 	FMassEntityQuery EntityQuery;
+
+	/* Kept between frames so the query buffers don't reallocate */
+	FSmbNeighborQueryBatch NeighborQueries;
+
+	/* Entity and push of every resolved pair side, chunks append under the lock */
+	TArray<TPair<FMassEntityHandle, FVector>> PendingPushes;
+	FCriticalSection PendingPushesLock;
+
+	/* Summed push per entity index, the apply pass zeroes what it consumes */
+	TArray<FVector> PushDeltas;
+
+	/* Sleepers pushed further than this in one frame wake up */
+	UPROPERTY(EditAnywhere, Category = "Smb")
+	float SleepWakePush = 0.5f;
 };
 
 
@@ -80,6 +138,21 @@ protected:
 	
 private:
 	FMassEntityQuery EntityQuery;
+
+	/* Kept between frames so the query buffers don't reallocate */
+	FSmbNeighborQueryBatch NeighborQueries;
+
+	/* Frames one round of enemy checks is spread over, each chunk is walked once per round */
+	UPROPERTY(EditAnywhere, Category = "Smb")
+	int32 NumFrameSlots = 8;
+
+	/* Most enemy queries resolved in one frame, the most overdue entities go first and the rest wait for their chunk's next turn */
+	UPROPERTY(EditAnywhere, Category = "Smb")
+	int32 MaxQueriesPerFrame = 2048;
+
+	uint64 FrameCounter = 0;
+	int32 CurrentSlot = 0;
+	int32 NextChunkSlot = 0;
 };
 
 
@@ -118,6 +191,42 @@ private:
 	FMassEntityQuery EntityQuery;
 };
 
+/* Spreads the grid, height and collision timers of new entities over their periods, so a spawned wave doesn't refresh in the same frame */
+UCLASS()
+class SCALABLEMASSBEHAVIOUR_API UStaggerLocationTimersProcessor : public UMassObserverProcessor
+{
+	GENERATED_BODY()
+
+public:
+	UStaggerLocationTimersProcessor();
+
+protected:
+	virtual void ConfigureQueries(const TSharedRef<FMassEntityManager>& EntityManager) override;
+
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+	
+private:
+	FMassEntityQuery EntityQuery;
+};
+
+/* Spreads the first enemy search of new entities over the check period */
+UCLASS()
+class SCALABLEMASSBEHAVIOUR_API UStaggerEnemyCheckProcessor : public UMassObserverProcessor
+{
+	GENERATED_BODY()
+
+public:
+	UStaggerEnemyCheckProcessor();
+
+protected:
+	virtual void ConfigureQueries(const TSharedRef<FMassEntityManager>& EntityManager) override;
+
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+	
+private:
+	FMassEntityQuery EntityQuery;
+};
+
 UCLASS()
 class SCALABLEMASSBEHAVIOUR_API UHeightProcessor : public UMassProcessor
 {
@@ -169,6 +278,28 @@ private:
 	FMassEntityQuery EntityQuery;
 };
 
+/* Turns the steering velocity of units on a move order along the order's flow field, steering still decides speed and the final approach */
+UCLASS()
+class SCALABLEMASSBEHAVIOUR_API UFlowFieldProcessor : public UMassProcessor
+{
+	GENERATED_BODY()
+
+public:
+	UFlowFieldProcessor();
+
+protected:
+	virtual void ConfigureQueries(const TSharedRef<FMassEntityManager>& EntityManager) override;
+
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+	
+private:
+	FMassEntityQuery EntityQuery;
+
+	/* How far the move target may sit from the ordered spot (walk target tasks snap it to the navmesh) and still count as the order */
+	UPROPERTY(EditAnywhere, Category = "Smb")
+	float DestinationTolerance = 300.f;
+};
+
 /*
 UCLASS()
 class SCALABLEMASSBEHAVIOUR_API UScaleProcessors : public UMassProcessor
@@ -0,0 +1,501 @@
+﻿// Copyright © 2025 Land Chaunax, All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "MassEntityHandle.h"
+
+class FSmbGridSnapshot;
+
+/* What the grid keeps next to every handle so queries can filter without touching the entity manager */
+struct FSmbGridEntityData
+{
+	FVector3f Location = FVector3f::ZeroVector;
+	float Radius = 0.f;
+	int32 Team = -2;
+	/* False once the entity is known to be dead */
+	bool bAlive = true;
+	/* Has a defence fragment and can take damage */
+	bool bDamageable = false;
+	/* Current HP when damageable, what the entity weighs on the influence map */
+	float Health = 0.f;
+};
+
+/* How many entities of one team sit in a coarse cell */
+struct FSmbGridTeamCount
+{
+	int32 Team = -2;
+	int32 Num = 0;
+	/* Alive and damageable, what enemy searches are after */
+	int32 NumTargetable = 0;
+};
+
+/* Aggregates of one coarse cell, lets long range queries skip whole regions before looking at fine cells */
+struct FSmbGridCoarseCellView
+{
+	TConstArrayView<FSmbGridTeamCount> Teams;
+
+	/* Any entity whose team isn't InTeam, what CollectClosestEntities with a team filter can return */
+	bool HasOtherTeamThan(int32 InTeam) const;
+	/* Any alive damageable entity of another team than InTeam */
+	bool HasTargetableEnemyOf(int32 InTeam) const;
+};
+
+/* Cell change produced by a parallel writer, applied later in one serial pass */
+struct FSmbGridMove
+{
+	FMassEntityHandle Handle;
+	FIntPoint Cell = FIntPoint::ZeroValue;
+	FSmbGridEntityData Data;
+};
+
+/* Consecutive slots of one team inside a snapshot cell */
+struct FSmbGridTeamRun
+{
+	int32 Team = -2;
+	int32 Start = 0;
+	int32 Num = 0;
+};
+
+/* Read only view of one cell, every array is indexed by the same slot */
+struct FSmbGridCellView
+{
+	TConstArrayView<FMassEntityHandle> Handles;
+	TConstArrayView<float> X;
+	TConstArrayView<float> Y;
+	TConstArrayView<float> Z;
+	TConstArrayView<float> Radius;
+	TConstArrayView<int32> Team;
+	TConstArrayView<uint8> Flags;
+	/* Snapshot cells are sorted by team and list their runs here, live grid cells leave this empty */
+	TConstArrayView<FSmbGridTeamRun> TeamRuns;
+
+	int32 Num() const { return Handles.Num(); }
+
+	/* Calls Visitor(Slot) for the slots whose team passes TeamFilter(Team), in a sorted cell a rejected team is skipped as a whole run */
+	template<typename TeamFilterType, typename VisitorType>
+	void ForEachSlotOfTeams(TeamFilterType&& TeamFilter, VisitorType&& Visitor) const
+	{
+		if (TeamRuns.Num() == 0)
+		{
+			for (int32 Slot = 0; Slot < Num(); ++Slot)
+			{
+				if (TeamFilter(Team[Slot])) Visitor(Slot);
+			}
+			return;
+		}
+		for (const FSmbGridTeamRun& Run : TeamRuns)
+		{
+			if (!TeamFilter(Run.Team)) continue;
+			for (int32 Slot = Run.Start; Slot < Run.Start+Run.Num; ++Slot)
+			{
+				Visitor(Slot);
+			}
+		}
+	}
+	FVector GetLocation(int32 Slot) const { return FVector(X[Slot], Y[Slot], Z[Slot]); }
+	bool IsAlive(int32 Slot) const;
+	bool IsDamageable(int32 Slot) const;
+};
+
+/* One "closest entities" question, answered together with the others of its batch by USmbSubsystem::ResolveNeighborQueries */
+struct FSmbNeighborQuery
+{
+	FMassEntityHandle Owner;
+	FVector Location = FVector::ZeroVector;
+	float Radius = 0.f;
+	/* Entities of this team are skipped, -1 behaves like CollectClosestEntities without a team */
+	int32 ExcludedTeam = -1;
+	int32 MaxCount = 0;
+	/* Where the answer starts in the batch results */
+	int32 ResultStart = 0;
+	/* Filled when resolved, sorted closest first */
+	int32 NumFound = 0;
+	/* Grid cell of Location, queries sharing a cell are answered from one gathered neighbourhood */
+	FIntPoint Cell = FIntPoint::ZeroValue;
+};
+
+/*
+ * Neighbour queries of one processor run. Filled serially in a first pass over the chunks,
+ * resolved in one go and then read back per entity from parallel chunks.
+ */
+struct SCALABLEMASSBEHAVIOUR_API FSmbNeighborQueryBatch
+{
+	TArray<FSmbNeighborQuery> Queries;
+	TArray<FMassEntityHandle> Results;
+
+	/* Queues a query for Owner, one per entity and batch */
+	void Add(FMassEntityHandle Owner, const FVector& Location, float Radius, int32 MaxCount, int32 ExcludedTeam = -1);
+	/* The answered query of Owner, nullptr if it didn't ask this run */
+	const FSmbNeighborQuery* Find(FMassEntityHandle Owner) const;
+	TConstArrayView<FMassEntityHandle> GetResults(const FSmbNeighborQuery& Query) const;
+	int32 Num() const { return Queries.Num(); }
+	void Reset();
+
+private:
+	/* Query index by FMassEntityHandle::Index, only the entries of the current queries are set */
+	TArray<int32> QueryOfEntity;
+	int32 NumResults = 0;
+
+	friend class USmbSubsystem;
+	/* Resolve scratch: query indices sorted by cell and where each cell's group starts */
+	TArray<int32> CellOrder;
+	TArray<int32> GroupStart;
+};
+
+/*
+ * Flat spatial hash used by USmbSubsystem to bucket entities by grid cell.
+ * Cells live in one dense array and are found through an open addressing table keyed by the packed cell coordinate,
+ * every entity remembers which cell and slot it sits in so moving or removing it is a swap remove instead of a search.
+ * Each cell stores its entities as parallel arrays (handle, position, radius, team, flags).
+ * Plain C++ on purpose, nothing in here is visible to the garbage collector.
+ */
+class SCALABLEMASSBEHAVIOUR_API FSmbSpatialGrid
+{
+public:
+	/* Team stored for entities without a team fragment */
+	static constexpr int32 NoTeam = -2;
+
+	enum EFlags : uint8
+	{
+		Alive = 1 << 0,
+		Damageable = 1 << 1,
+	};
+
+	/* Puts the handle into the given cell, moving it out of its previous cell if needed, and refreshes its data */
+	void AddToGrid(int32 X, int32 Y, FMassEntityHandle Handle, const FSmbGridEntityData& Data);
+	/*
+	 * Refreshes the data of a handle already registered in the given cell and returns true, anything else returns false and has to go through AddToGrid.
+	 * Only writes the handle's own slot, so different handles can be updated from several threads as long as nothing adds or removes at the same time.
+	 */
+	bool TryUpdateInPlace(int32 X, int32 Y, FMassEntityHandle Handle, const FSmbGridEntityData& Data);
+	/* Removes the handle from whatever cell it is registered in */
+	void RemoveFromGrid(FMassEntityHandle Handle);
+
+	/* Handles registered in the given cell, the view is invalidated by the next add or remove */
+	TConstArrayView<FMassEntityHandle> GetAt(int32 X, int32 Y) const;
+	/* Handles in the square of cells from X-Radius to X+Radius (inclusive), same for Y */
+	TArray<FMassEntityHandle> GetAround(int32 X, int32 Y, int32 Radius) const;
+
+	/* Same cells as GetAround but hands each non empty cell to the visitor as a view instead of copying, no heap is touched */
+	template<typename VisitorType>
+	void ForEachCellAround(int32 X, int32 Y, int32 Radius, VisitorType&& Visitor) const
+	{
+		for (int32 i = -Radius; i <= Radius; ++i)
+		{
+			for (int32 j = -Radius; j <= Radius; ++j)
+			{
+				const int32 CellIndex = FindCell(X+i, Y+j);
+				if (CellIndex == INDEX_NONE) continue;
+				if (Cells[CellIndex].Handles.Num() == 0) continue;
+				Visitor(MakeCellView(Cells[CellIndex]));
+			}
+		}
+	}
+
+	bool Contains(FMassEntityHandle Handle) const;
+	int32 Num() const { return NumRegistered; }
+
+	void EmptySelf();
+
+private:
+	friend class FSmbGridSnapshot;
+
+	struct FCell
+	{
+		FIntPoint Coord = FIntPoint::ZeroValue;
+		TArray<FMassEntityHandle> Handles;
+		TArray<float> X;
+		TArray<float> Y;
+		TArray<float> Z;
+		TArray<float> Radius;
+		TArray<int32> Team;
+		TArray<uint8> Flags;
+	};
+
+	/* Where a registered entity lives, indexed by FMassEntityHandle::Index */
+	struct FEntry
+	{
+		int32 SerialNumber = 0;
+		int32 CellIndex = INDEX_NONE;
+		int32 Slot = INDEX_NONE;
+	};
+
+	struct FTableSlot
+	{
+		uint64 Key = 0;
+		int32 CellIndex = INDEX_NONE;
+	};
+
+	static uint64 PackCoord(int32 X, int32 Y)
+	{
+		return (static_cast<uint64>(static_cast<uint32>(X)) << 32) | static_cast<uint32>(Y);
+	}
+	static uint32 HashKey(uint64 Key);
+	static int32 FindCellInTable(TConstArrayView<FTableSlot> Table, int32 X, int32 Y);
+	/* Table must have a free slot and not contain the coordinate yet */
+	static void InsertIntoTable(TArray<FTableSlot>& Table, int32 X, int32 Y, int32 CellIndex);
+	static FSmbGridCellView MakeCellView(const FCell& Cell);
+	static void WriteSlot(FCell& Cell, int32 Slot, const FSmbGridEntityData& Data);
+
+	int32 FindCell(int32 X, int32 Y) const;
+	int32 FindOrAddCell(int32 X, int32 Y);
+	void GrowTable();
+	void RemoveEntry(FEntry& Entry);
+
+	TArray<FCell> Cells;
+	TArray<FEntry> Entries;
+	TArray<FTableSlot> Table;
+	int32 NumRegistered = 0;
+};
+
+/*
+ * Immutable copy of FSmbSpatialGrid, taken once per frame after registration so parallel processors can query it without locks.
+ * Cells are stored back to back (compressed rows): one flat array per field and the start offset of every cell.
+ * Inside a cell entities are sorted by team, so enemy searches jump over the runs of friendly units.
+ * Cell indices and the lookup table match the grid it was built from.
+ * On top of the fine cells sits a coarse level, CoarseFactor x CoarseFactor fine cells each, holding per team counts.
+ * Short range queries (collision) walk fine cells directly, long range ones go through the coarse level and only open
+ * coarse cells their filter accepts, so a region without enemies costs one lookup instead of every handle in it.
+ */
+class SCALABLEMASSBEHAVIOUR_API FSmbGridSnapshot
+{
+public:
+	/* Copies the grid, reusing the allocations of the previous build */
+	void Build(const FSmbSpatialGrid& Grid, int32 InCoarseFactor);
+
+	/*
+	 * Visits every non empty cell whose bounds touch the circle around Center, CellSize is the world size of a cell.
+	 * Cells of the covering square that only overlap it in a corner are skipped.
+	 */
+	template<typename VisitorType>
+	void ForEachCellInRadius(const FVector2D& Center, float Radius, float CellSize, VisitorType&& Visitor) const
+	{
+		if (Radius < 0.f || CellSize <= 0.f) return;
+		const int32 MinX = FMath::FloorToInt32((Center.X-Radius)/CellSize);
+		const int32 MaxX = FMath::FloorToInt32((Center.X+Radius)/CellSize);
+		const int32 MinY = FMath::FloorToInt32((Center.Y-Radius)/CellSize);
+		const int32 MaxY = FMath::FloorToInt32((Center.Y+Radius)/CellSize);
+		const double RadiusSquared = static_cast<double>(Radius)*Radius;
+		for (int32 CellX = MinX; CellX <= MaxX; ++CellX)
+		{
+			for (int32 CellY = MinY; CellY <= MaxY; ++CellY)
+			{
+				if (!CellTouchesCircle(CellX, CellY, CellSize, Center, RadiusSquared)) continue;
+				VisitCell(CellX, CellY, Visitor);
+			}
+		}
+	}
+
+	/*
+	 * Same cells as ForEachCellInRadius, but coarse cells are tested first and skipped when CoarseFilter(FSmbGridCoarseCellView) is false.
+	 * Cells come grouped by coarse cell, not in row order.
+	 */
+	template<typename CoarseFilterType, typename VisitorType>
+	void ForEachCellInRadiusPruned(const FVector2D& Center, float Radius, float CellSize, CoarseFilterType&& CoarseFilter, VisitorType&& Visitor) const
+	{
+		if (Radius < 0.f || CellSize <= 0.f) return;
+		const double CoarseSize = static_cast<double>(CellSize)*CoarseFactor;
+		const int32 MinX = FMath::FloorToInt32((Center.X-Radius)/CoarseSize);
+		const int32 MaxX = FMath::FloorToInt32((Center.X+Radius)/CoarseSize);
+		const int32 MinY = FMath::FloorToInt32((Center.Y-Radius)/CoarseSize);
+		const int32 MaxY = FMath::FloorToInt32((Center.Y+Radius)/CoarseSize);
+		const double RadiusSquared = static_cast<double>(Radius)*Radius;
+		for (int32 CoarseX = MinX; CoarseX <= MaxX; ++CoarseX)
+		{
+			for (int32 CoarseY = MinY; CoarseY <= MaxY; ++CoarseY)
+			{
+				if (!CellTouchesCircle(CoarseX, CoarseY, CoarseSize, Center, RadiusSquared)) continue;
+				const int32 CoarseIndex = FSmbSpatialGrid::FindCellInTable(CoarseTable, CoarseX, CoarseY);
+				if (CoarseIndex == INDEX_NONE) continue;
+				if (!CoarseFilter(MakeCoarseCellView(CoarseIndex))) continue;
+				for (int32 i = CoarseFineStart[CoarseIndex]; i < CoarseFineStart[CoarseIndex+1]; ++i)
+				{
+					const int32 CellIndex = CoarseFineCells[i];
+					if (!CellTouchesCircle(CellCoords[CellIndex].X, CellCoords[CellIndex].Y, CellSize, Center, RadiusSquared)) continue;
+					Visitor(MakeCellView(CellIndex));
+				}
+			}
+		}
+	}
+
+	/*
+	 * Visits the cells touching the circle ring by ring, starting with the cell holding Center.
+	 * Before each ring ShouldStop(RingDistanceSquared) gets the smallest squared 2D distance an entity of that ring can have,
+	 * returning true ends the search so nearest neighbour queries stop once nothing further out can beat what they have.
+	 * CoarseFilter works like in ForEachCellInRadiusPruned.
+	 */
+	template<typename CoarseFilterType, typename StopType, typename VisitorType>
+	void ForEachCellByRing(const FVector2D& Center, float Radius, float CellSize, CoarseFilterType&& CoarseFilter, StopType&& ShouldStop, VisitorType&& Visitor) const
+	{
+		if (Radius < 0.f || CellSize <= 0.f) return;
+		const int32 CenterX = FMath::FloorToInt32(Center.X/CellSize);
+		const int32 CenterY = FMath::FloorToInt32(Center.Y/CellSize);
+		// Distance from Center to the nearest edge of its own cell, every ring after the first adds one cell to it
+		const double OffsetX = Center.X-static_cast<double>(CenterX)*CellSize;
+		const double OffsetY = Center.Y-static_cast<double>(CenterY)*CellSize;
+		const double EdgeDistance = FMath::Min(FMath::Min(OffsetX, CellSize-OffsetX), FMath::Min(OffsetY, CellSize-OffsetY));
+		const double RadiusSquared = static_cast<double>(Radius)*Radius;
+
+		// Neighbouring fine cells mostly share a coarse cell, remember the last verdict instead of looking it up again
+		FIntPoint CachedCoarse = FIntPoint(MAX_int32, MAX_int32);
+		bool bCachedCoarseAccepted = false;
+		auto VisitRingCell = [&](int32 CellX, int32 CellY)
+		{
+			if (!CellTouchesCircle(CellX, CellY, CellSize, Center, RadiusSquared)) return;
+			const FIntPoint Coarse = FIntPoint(FloorDiv(CellX, CoarseFactor), FloorDiv(CellY, CoarseFactor));
+			if (Coarse != CachedCoarse)
+			{
+				CachedCoarse = Coarse;
+				const int32 CoarseIndex = FSmbSpatialGrid::FindCellInTable(CoarseTable, Coarse.X, Coarse.Y);
+				bCachedCoarseAccepted = CoarseIndex != INDEX_NONE && CoarseFilter(MakeCoarseCellView(CoarseIndex));
+			}
+			if (!bCachedCoarseAccepted) return;
+			VisitCell(CellX, CellY, Visitor);
+		};
+
+		for (int32 Ring = 0; ; ++Ring)
+		{
+			const double RingDistance = Ring == 0 ? 0.0 : EdgeDistance+static_cast<double>(Ring-1)*CellSize;
+			if (RingDistance > Radius) return;
+			if (ShouldStop(RingDistance*RingDistance)) return;
+			if (Ring == 0)
+			{
+				VisitRingCell(CenterX, CenterY);
+				continue;
+			}
+			for (int32 CellX = CenterX-Ring; CellX <= CenterX+Ring; ++CellX)
+			{
+				VisitRingCell(CellX, CenterY-Ring);
+			}
+			for (int32 CellX = CenterX-Ring; CellX <= CenterX+Ring; ++CellX)
+			{
+				VisitRingCell(CellX, CenterY+Ring);
+			}
+			for (int32 CellY = CenterY-Ring+1; CellY < CenterY+Ring; ++CellY)
+			{
+				VisitRingCell(CenterX-Ring, CellY);
+			}
+			for (int32 CellY = CenterY-Ring+1; CellY < CenterY+Ring; ++CellY)
+			{
+				VisitRingCell(CenterX+Ring, CellY);
+			}
+		}
+	}
+
+	/* Visits every non empty cell overlapping the world space rectangle */
+	template<typename VisitorType>
+	void ForEachCellInBounds(const FBox2D& Bounds, float CellSize, VisitorType&& Visitor) const
+	{
+		if (!Bounds.bIsValid || CellSize <= 0.f) return;
+		const int32 MinX = FMath::FloorToInt32(Bounds.Min.X/CellSize);
+		const int32 MaxX = FMath::FloorToInt32(Bounds.Max.X/CellSize);
+		const int32 MinY = FMath::FloorToInt32(Bounds.Min.Y/CellSize);
+		const int32 MaxY = FMath::FloorToInt32(Bounds.Max.Y/CellSize);
+		for (int32 CellX = MinX; CellX <= MaxX; ++CellX)
+		{
+			for (int32 CellY = MinY; CellY <= MaxY; ++CellY)
+			{
+				VisitCell(CellX, CellY, Visitor);
+			}
+		}
+	}
+
+	bool Contains(FMassEntityHandle Handle) const;
+	int32 Num() const { return Handles.Num(); }
+
+	/* Largest entity radius in the snapshot, queries that test against entity bounds pad their search radius by this */
+	float GetMaxRadius() const { return MaxRadius; }
+
+	void Empty();
+
+private:
+	static int32 FloorDiv(int32 Value, int32 Divisor)
+	{
+		return Value >= 0 ? Value/Divisor : (Value-Divisor+1)/Divisor;
+	}
+
+	/* True when the square cell of the given size comes within the radius of Center */
+	static bool CellTouchesCircle(int32 CellX, int32 CellY, double CellSize, const FVector2D& Center, double RadiusSquared)
+	{
+		// Distance from the center to the cell along each axis, zero when the center is inside its span
+		const double CellMinX = static_cast<double>(CellX)*CellSize;
+		const double CellMinY = static_cast<double>(CellY)*CellSize;
+		const double DistX = FMath::Max3(CellMinX-Center.X, 0.0, Center.X-(CellMinX+CellSize));
+		const double DistY = FMath::Max3(CellMinY-Center.Y, 0.0, Center.Y-(CellMinY+CellSize));
+		return DistX*DistX+DistY*DistY <= RadiusSquared;
+	}
+
+	template<typename VisitorType>
+	void VisitCell(int32 CellX, int32 CellY, VisitorType& Visitor) const
+	{
+		const int32 CellIndex = FSmbSpatialGrid::FindCellInTable(Table, CellX, CellY);
+		if (CellIndex == INDEX_NONE) return;
+		if (CellStart[CellIndex] == CellStart[CellIndex+1]) return;
+		Visitor(MakeCellView(CellIndex));
+	}
+
+	FSmbGridCellView MakeCellView(int32 CellIndex) const;
+	FSmbGridCoarseCellView MakeCoarseCellView(int32 CoarseIndex) const;
+	void BuildCoarseLevel();
+
+	TArray<FSmbSpatialGrid::FTableSlot> Table;
+	TArray<FIntPoint> CellCoords;
+	/* Cell i owns the flat range [CellStart[i], CellStart[i+1]) */
+	TArray<int32> CellStart;
+	TArray<FMassEntityHandle> Handles;
+	TArray<float> X;
+	TArray<float> Y;
+	TArray<float> Z;
+	TArray<float> Radius;
+	TArray<int32> Team;
+	TArray<uint8> Flags;
+	/* Team runs of cell i are TeamRuns[CellRunStart[i]..CellRunStart[i+1]) */
+	TArray<int32> CellRunStart;
+	TArray<FSmbGridTeamRun> TeamRuns;
+	/* Flat index by FMassEntityHandle::Index, INDEX_NONE when the entity isn't in the snapshot */
+	TArray<int32> EntityToFlat;
+	float MaxRadius = 0.f;
+
+	int32 CoarseFactor = 1;
+	TArray<FSmbSpatialGrid::FTableSlot> CoarseTable;
+	/* Non empty fine cells of coarse cell i are CoarseFineCells[CoarseFineStart[i]..CoarseFineStart[i+1]) */
+	TArray<int32> CoarseFineStart;
+	TArray<int32> CoarseFineCells;
+	/* Team counts of coarse cell i are CoarseTeams[CoarseTeamStart[i]..CoarseTeamStart[i+1]) */
+	TArray<int32> CoarseTeamStart;
+	TArray<FSmbGridTeamCount> CoarseTeams;
+	/* Build scratch, kept to avoid reallocating every frame */
+	TArray<int32> FineToCoarse;
+	TArray<int32> CoarseCursor;
+	TArray<int32> SlotOrder;
+};
+
+inline bool FSmbGridCellView::IsAlive(int32 Slot) const
+{
+	return (Flags[Slot] & FSmbSpatialGrid::Alive) != 0;
+}
+
+inline bool FSmbGridCellView::IsDamageable(int32 Slot) const
+{
+	return (Flags[Slot] & FSmbSpatialGrid::Damageable) != 0;
+}
+
+inline bool FSmbGridCoarseCellView::HasOtherTeamThan(int32 InTeam) const
+{
+	for (const FSmbGridTeamCount& TeamCount : Teams)
+	{
+		if (TeamCount.Team != InTeam && TeamCount.Num > 0) return true;
+	}
+	return false;
+}
+
+inline bool FSmbGridCoarseCellView::HasTargetableEnemyOf(int32 InTeam) const
+{
+	for (const FSmbGridTeamCount& TeamCount : Teams)
+	{
+		if (TeamCount.Team == InTeam || TeamCount.Team == FSmbSpatialGrid::NoTeam) continue;
+		if (TeamCount.NumTargetable > 0) return true;
+	}
+	return false;
+}
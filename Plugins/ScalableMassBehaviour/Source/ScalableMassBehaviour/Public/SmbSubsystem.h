@@ -3,12 +3,21 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+#include <atomic>
 #include "MassEntityConfigAsset.h"
 #include "Subsystems/WorldSubsystem.h"
 #include "ScalableMassBehaviour.h"
 #include "MassSubsystemBase.h"
 #include "SmbAssetManager.h"
 #include "SmbFragments.h"
+#include "SmbSpatialGrid.h"
+#include "SmbInfluenceMap.h"
+#include "SmbFlowField.h"
+#include "SmbNavProjection.h"
+#include "SmbHeightCache.h"
+#include "SmbTraceBatch.h"
+#include "Tasks/Task.h"
 #include "TaskSyncManager.h"
 
 #include "SmbSubsystem.generated.h"
@@ -20,6 +29,8 @@ class ASmbProjectileHandler;
 class USmbAnimComp;
 class ASmbPhysicsManager;
 class UMassAgentComponent;
+class UNavigationSystemV1;
+class ANavigationData;
 
 
 struct FMassEntityHandle;
@@ -90,53 +101,6 @@ struct FResourceReqMap
 	TMap<EProcessable, FProcessableReqArr> ReqMap = TMap<EProcessable, FProcessableReqArr>();
 };
 
-UCLASS()
-class UGridCell : public UObject
-{
-	GENERATED_BODY()
-
-public:
-	UPROPERTY()
-	TArray<FMassEntityHandle> Handles;
-
-	UFUNCTION()
-	void EmptySelf();
-};
-
-UCLASS()
-class UGridCellY : public UObject
-{
-	GENERATED_BODY()
-
-public:
-	UPROPERTY(EditAnywhere, Category = "Smb")
-	TMap<int32, UGridCell*> YCells;
-
-	void EmptySelf();
-};
-
-UCLASS()
-class UGrid : public UObject
-{
-	GENERATED_BODY()
-
-public:
-	UPROPERTY()
-	TMap<int32, UGridCellY*> XCells = TMap<int32, UGridCellY*>();
-	UFUNCTION()
-	TArray<FMassEntityHandle> GetAt(int32 X, int32 Y);
-	UFUNCTION()
-	TArray<FMassEntityHandle> RemoveAt(int32 X, int32 Y, FMassEntityHandle ToRemoveHandle);
-	UFUNCTION()
-	TArray<FMassEntityHandle> GetAround(int32 X, int32 Y, int32 Radius);
-
-	UFUNCTION()
-	void AddToGrid(int32 X, int32 Y, FMassEntityHandle Handle);
-
-	UFUNCTION()
-	void EmptySelf();
-};
-
 USTRUCT()
 struct FProcessableArr
 {
@@ -164,6 +128,7 @@ struct FPhysicsManagerStruct
 };
 
 
+/* Grid queries only read the published snapshot, so processors that just query can declare ReadOnly access and run side by side */
 template<>
 struct TMassExternalSubsystemTraits<USmbSubsystem>
 {
@@ -217,7 +182,7 @@ public:
 	UPROPERTY(BlueprintReadWrite, Category = "Smb")
 	float TimeSinceRemoval = 0.f;
 	UFUNCTION(BlueprintCallable, Category = "Smb")
-	FVector2D VectorToCell(FVector Location);
+	FVector2D VectorToCell(FVector Location) const;
 	UFUNCTION(BlueprintCallable, Category = "Smb")
 	bool RegisterResource(FVector Location, EProcessable Type, UMassAgentComponent* Component);
 	UFUNCTION(BlueprintCallable, Category = "Smb")
@@ -253,10 +218,42 @@ public:
 	UFUNCTION()
 	void SpawnAbilityDataDeferred(USmbAbilityData* AbilityData, const FTransform& Transform, float Delay = 0.f);
 	
-	/* Sets walk target vector for given entities */ 
+	/* Sets walk target vector for given entities, they follow one shared flow field there */ 
 	UFUNCTION(BlueprintCallable, Category = "Smb")
 	bool MoveEntities(TArray<FSmbEntityData> Units, FVector NewLocation, int32 Team = -1);
 
+	/*
+	 * Id of a flow field leading from anywhere in Bounds to the area GoalRadius around Goal. A cached field covering the order is reused,
+	 * otherwise a new one is sampled by the following ticks and then built on a worker thread. INDEX_NONE without a navmesh and while
+	 * the navmesh is being rebuilt.
+	 */
+	int32 RequestFlowField(const FVector& Goal, float GoalRadius, const FBox2D& Bounds);
+	/* The field once built, nullptr while it builds and after it was dropped */
+	const FSmbFlowField* FindReadyFlowField(int32 FlowFieldId) const;
+	/* False once the field was dropped from the cache, followers let go of it then */
+	bool HasFlowField(int32 FlowFieldId) const { return FlowFields.Contains(FlowFieldId); }
+
+	/* Queues navmesh projections for the end of the frame, thread safe. Height and walk target results are written into the owner's fragments when resolved */
+	void QueueNavProjections(TArray<FSmbNavProjection>& Projections) { NavProjections.Submit(Projections); }
+	void QueueNavProjection(const FSmbNavProjection& Projection) { NavProjections.Submit(Projection); }
+
+	/* Ground traces for the batch launched after the current processing pass, thread safe */
+	void QueueGroundTraces(TArray<FSmbGroundTrace>& Traces) { GroundTraces.Submit(Traces); }
+	/* Traces everything queued on worker threads, a later pass collects them with CompleteGroundTraces. Game thread */
+	void LaunchGroundTraces() { GroundTraces.Launch(*GetWorld(), ECC_WorldStatic); }
+	/* FindGroundTrace answers with the launched traces once they are done, false without waiting while they still run. Game thread */
+	bool CompleteGroundTraces() { return GroundTraces.Complete(); }
+	const FSmbGroundTrace* FindGroundTrace(FMassEntityHandle Owner) const { return GroundTraces.Find(Owner); }
+
+	/* Ground heights sampled from the navmesh, read only while processors run */
+	const FSmbHeightCache& GetHeightCache() const { return HeightCache; }
+	/* Samples missing from the height cache, thread safe. They are projected at the end of the frame */
+	void QueueHeightSamples(TArray<FVector>& Samples) { HeightCache.Submit(Samples); }
+	bool IsHeightCacheEnabled() const { return bUseHeightCache; }
+
+	/* Lets sleeping entities register and collide again, for anything that disturbs them from outside the collision processor */
+	void WakeEntities(TConstArrayView<FMassEntityHandle> Handles);
+
 	/* Deals Damage in an AOE */
 	UFUNCTION(BlueprintCallable, Category = "Smb")
 	bool DealDamageAoe(FVector InLocation, float Radius, float DamageAmount, EDamageType DamageType, int32 OwnTeam, int32 &AmountKilled);
@@ -271,11 +268,87 @@ public:
 	//TArray<FMassEntityHandle> GetNearbyUnits(FVector Location, float Radius);
 	UFUNCTION()
 	TArray<FMassEntityHandle> GetNumberClosestEntities(FVector Location, float Radius, int32 Amount, int32 Team = -1);
+	/* Allocation free version for processors, fills OutClosest with up to OutClosest.Num() handles sorted by distance and returns how many were found */
+	int32 CollectClosestEntities(const FVector& Location, float Radius, TArrayView<FMassEntityHandle> OutClosest, int32 Team = -1) const;
+	/*
+	 * Answers every query of the batch like CollectClosestEntities would, but queries asked from the same cell share one gathered
+	 * neighbourhood and cells are resolved in parallel. Results land in Batch.Results, read them back with Batch.Find.
+	 */
+	void ResolveNeighborQueries(FSmbNeighborQueryBatch& Batch) const;
+
+	/* Visits every entity registered in the cells touching Radius around Location as (CellView, Slot), nothing is copied or allocated */
+	template<typename VisitorType>
+	void ForEachInRadius(const FVector& Location, float Radius, VisitorType&& Visitor) const
+	{
+		GetGridSnapshot().ForEachCellInRadius(FVector2D(Location), Radius, CellSize, [&Visitor](const FSmbGridCellView& CellView)
+		{
+			for (int32 Slot = 0; Slot < CellView.Num(); ++Slot)
+			{
+				Visitor(CellView, Slot);
+			}
+		});
+	}
+	/*
+	 * ForEachInRadius through the coarse level, regions where CoarseFilter(FSmbGridCoarseCellView) is false are skipped whole
+	 * and inside a cell only the team runs accepted by TeamFilter(Team) are visited.
+	 */
+	template<typename CoarseFilterType, typename TeamFilterType, typename VisitorType>
+	void ForEachInRadiusPruned(const FVector& Location, float Radius, CoarseFilterType&& CoarseFilter, TeamFilterType&& TeamFilter, VisitorType&& Visitor) const
+	{
+		GetGridSnapshot().ForEachCellInRadiusPruned(FVector2D(Location), Radius, CellSize, CoarseFilter, [&TeamFilter, &Visitor](const FSmbGridCellView& CellView)
+		{
+			CellView.ForEachSlotOfTeams(TeamFilter, [&CellView, &Visitor](int32 Slot)
+			{
+				Visitor(CellView, Slot);
+			});
+		});
+	}
+	/*
+	 * ForEachInRadiusPruned walking outward ring by ring, ShouldStop(RingDistanceSquared) is asked before every ring
+	 * so nearest neighbour searches end as soon as the next ring is farther than their worst kept candidate.
+	 */
+	template<typename CoarseFilterType, typename TeamFilterType, typename StopType, typename VisitorType>
+	void ForEachNearestFirst(const FVector& Location, float Radius, CoarseFilterType&& CoarseFilter, TeamFilterType&& TeamFilter, StopType&& ShouldStop, VisitorType&& Visitor) const
+	{
+		GetGridSnapshot().ForEachCellByRing(FVector2D(Location), Radius, CellSize, CoarseFilter, ShouldStop, [&TeamFilter, &Visitor](const FSmbGridCellView& CellView)
+		{
+			CellView.ForEachSlotOfTeams(TeamFilter, [&CellView, &Visitor](int32 Slot)
+			{
+				Visitor(CellView, Slot);
+			});
+		});
+	}
 	UFUNCTION(BlueprintCallable, Category = "Smb")
 	bool LowerResource(TMap<EProcessable, int32> CostResourceMap);
 
-	UFUNCTION()
-	FVector RegisterToGrid(FVector NewLocation, FMassEntityHandle Handle, FVector OldLocation);
+	/* Moves the entity to the cell of Data.Location and refreshes the data queries filter on */
+	void RegisterToGrid(FMassEntityHandle Handle, const FSmbGridEntityData& Data);
+	/* Thread safe for different handles, entities staying in their cell are written directly and the rest are added to OutMoves for QueueGridMoves */
+	void UpdateGridEntity(FMassEntityHandle Handle, const FSmbGridEntityData& Data, TArray<FSmbGridMove>& OutMoves);
+	/* Hands over the cell changes of one chunk, can be called from parallel chunks */
+	void QueueGridMoves(TArray<FSmbGridMove>& ChunkMoves);
+	/* Applies queued cell changes in entity index order so the grid layout doesn't depend on which chunk finished first */
+	void FlushGridMoves();
+	/* Rebuilds the back snapshot from the live grid and makes it the one queries read */
+	void PublishGridSnapshot();
+	/* What every query reads, stays untouched until the next PublishGridSnapshot so parallel readers need no lock */
+	const FSmbGridSnapshot& GetGridSnapshot() const { return GridSnapshots[ReadSnapshotIndex.load(std::memory_order_acquire)]; }
+
+	/* Per team HP sums on a coarse grid, kept current by the grid flush and the damage functions, game thread only like the live grid */
+	const FSmbInfluenceMap& GetInfluenceMap() const { return Influence; }
+	/* Influence cell holding Location, InfluenceCellFactor fine cells per side */
+	FIntPoint LocationToInfluenceCell(const FVector& Location) const;
+	/* False when no enemy of Team that can be damaged is in the influence cells reaching Radius plus the widest agent around Location, enemy searches skip their query then */
+	bool HasEnemyInfluence(const FVector& Location, float Radius, int32 Team) const;
+	/* Summed HP of the enemies of Team in the influence cell of Location */
+	UFUNCTION(BlueprintCallable, Category = "Smb")
+	float GetEnemyInfluence(FVector Location, int32 Team) const;
+	/*
+	 * Flat direction from Location to the centre of the influence cell holding the most enemy HP, looking at its own cell and the eight around it.
+	 * False when none of them holds an enemy of Team. The own cell winning gives a direction to its centre, not to the enemies in it
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Smb")
+	bool GetStrongestThreatDirection(FVector Location, int32 Team, FVector& OutDirection, float& OutStrength) const;
 
 	UFUNCTION(BlueprintCallable, Category = "Smb")
 	bool RegisterPhysicsManager(ASmbPhysicsManager* InScalePhysicsManager, FString MeshName);
@@ -352,13 +425,78 @@ protected:
 	UFUNCTION()
 	void DestroyStalledEntity(float DeltaTime);
 	
-	UPROPERTY()
-	TObjectPtr<UGrid> Grid = TObjectPtr<UGrid>();
+	FSmbSpatialGrid Grid;
+	FSmbGridSnapshot GridSnapshots[2];
+	std::atomic<int32> ReadSnapshotIndex = 0;
+	TArray<FSmbGridMove> PendingGridMoves;
+	FCriticalSection PendingGridMovesLock;
+	FSmbInfluenceMap Influence;
+
+	struct FFlowFieldEntry
+	{
+		TSharedPtr<FSmbFlowField, ESPMode::ThreadSafe> Field;
+		/* Invalid until the field is sampled */
+		UE::Tasks::FTask BuildTask;
+	};
+	TMap<int32, FFlowFieldEntry> FlowFields;
+	int32 NextFlowFieldId = 0;
+	/* Samples the navmesh for the waiting fields within MaxFlowFieldSamplesPerFrame and launches the builds of those done sampling. Game thread */
+	void AdvanceFlowFieldBuilds();
+	/* Stops and drops every field still sampling or building, their samples may predate a rebuild */
+	void CancelFlowFieldBuilds();
+
+	FSmbNavProjectionService NavProjections;
+	/* Writes the heights resolved this frame into the owners, and moves walk targets onto the navmesh unless the entity was given another target meanwhile */
+	void ApplyNavProjections();
+
+	FSmbTraceBatch GroundTraces;
+
+	FSmbHeightCache HeightCache;
+	TWeakObjectPtr<UNavigationSystemV1> InvalidationNavSys;
+	/* Binds height cache invalidation and flow field cancellation to navmesh rebuilds once the navigation system exists */
+	void BindNavigationInvalidation();
+	UFUNCTION()
+	void OnNavigationGenerationFinished(ANavigationData* NavData);
 	
 	TSharedPtr<FMassEntityManager> EntityManagerPtr;
 	UE::Mass::FEntityBuilder* EntityBuilder = nullptr;
 
+	/* Fine level, sized for collision checks */
+	UPROPERTY()
+	float CellSize = 250.f;
+	/* Fine cells per coarse cell side, the coarse level answers long range enemy searches */
+	UPROPERTY()
+	int32 CoarseCellFactor = 8;
+	/* Fine cells per influence cell side, one influence cell is what team level awareness resolves */
+	UPROPERTY()
+	int32 InfluenceCellFactor = 8;
+
+	/* Flow field cell size, fields of large orders use bigger cells to stay under MaxFlowFieldCellsPerSide */
+	UPROPERTY()
+	float FlowFieldCellSize = 200.f;
+	UPROPERTY()
+	int32 MaxFlowFieldCellsPerSide = 256;
+	/* Room around the units and the destination a field covers, so the way around obstacles between them fits in */
 	UPROPERTY()
-	float CellSize = 500.f;
+	float FlowFieldMargin = 3000.f;
+	/* Fields kept for reuse, the least recently used finished one goes first */
+	UPROPERTY()
+	int32 MaxCachedFlowFields = 16;
+	/* Seconds a field is reused for, newer orders build a fresh one in case the navmesh changed */
+	UPROPERTY()
+	float FlowFieldMaxAge = 60.f;
+	/* Flow field cells projected onto the navmesh per frame at most, large fields are sampled over several frames */
+	UPROPERTY(EditAnywhere, Category = "Smb")
+	int32 MaxFlowFieldSamplesPerFrame = 4096;
+
+	/* Height processing reads ground heights from the cache, only asking the navmesh per entity where the cache has no answer */
+	UPROPERTY(EditAnywhere, Category = "Smb")
+	bool bUseHeightCache = true;
+	/* Distance between height cache samples, smaller follows the ground closer but needs more projections to fill */
+	UPROPERTY(EditAnywhere, Category = "Smb")
+	float HeightCacheSpacing = 100.f;
+	/* Height cache samples projected per frame at most, the rest wait for later frames */
+	UPROPERTY(EditAnywhere, Category = "Smb")
+	int32 MaxHeightSamplesPerFrame = 4096;
 };
 
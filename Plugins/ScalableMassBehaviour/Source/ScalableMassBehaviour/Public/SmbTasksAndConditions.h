@@ -65,6 +65,40 @@ struct FGetOwnLocation : public FMassStateTreeTaskBase
 	TStateTreeExternalDataHandle<FTransformFragment> EntityTransformHandle;
 };
 
+USTRUCT()
+struct FGetThreatDirectionInstanceData
+{
+	GENERATED_BODY()
+
+	/* Flat unit direction towards the strongest enemy presence around the entity, zero when there is none */
+	UPROPERTY(EditAnywhere, Category = Output)
+	FVector ThreatDirection = FVector::ZeroVector;
+	/* Summed enemy HP of the influence cell the direction points to */
+	UPROPERTY(EditAnywhere, Category = Output)
+	float ThreatStrength = 0.f;
+};
+
+/* Reads the team influence map of the subsystem instead of searching for enemies, fails when no enemy is in the surrounding influence cells */
+USTRUCT(meta = (DisplayName = "SMB Get Threat Direction"))
+struct FGetThreatDirection : public FMassStateTreeTaskBase
+{
+	GENERATED_BODY()
+
+	using FInstanceDataType = FGetThreatDirectionInstanceData;
+
+	FGetThreatDirection();
+
+	virtual bool Link(FStateTreeLinker& Linker) override;
+	virtual const UStruct* GetInstanceDataType() const override { return FGetThreatDirectionInstanceData::StaticStruct(); };
+	
+	virtual EStateTreeRunStatus EnterState(FStateTreeExecutionContext& Context, const FStateTreeTransitionResult& Transition) const override;
+	virtual void GetDependencies(UE::MassBehavior::FStateTreeDependencyBuilder& Builder) const override;
+	
+	TStateTreeExternalDataHandle<FTransformFragment> EntityTransformHandle;
+	TStateTreeExternalDataHandle<FTeamFragment> TeamFragmentHandle;
+	TStateTreeExternalDataHandle<USmbSubsystem> SmbSubsystemHandle;
+};
+
 struct FMassMoveTargetFragment;
 
 USTRUCT()
@@ -99,8 +133,9 @@ struct FGetRandomLocationInRange : public FMassStateTreeTaskBase
 	
 	TStateTreeExternalDataHandle<FAnimationFragment> AnimationFragmentHandle;
 	TStateTreeExternalDataHandle<FDeathPhysicsSharedFragment> DeathFragmentHandle;
-	TStateTreeExternalDataHandle<FLocationDataFragment> LocationDataFragmentHandle;
+	TStateTreeExternalDataHandle<FLocationTargetFragment> LocationTargetFragmentHandle;
 	TStateTreeExternalDataHandle<FTransformFragment> TransformFragmentHandle;
+	TStateTreeExternalDataHandle<USmbSubsystem> SmbSubsystemHandle;
 	//TStateTreeExternalDataHandle<UNavigationSystemV1> NavigationSystemHandle;
 	
 	virtual EStateTreeRunStatus EnterState(FStateTreeExecutionContext& Context, const FStateTreeTransitionResult& Transition) const override;
@@ -255,7 +290,7 @@ struct FIsCloseEnoughCondition : public FStateTreeConditionBase
 	virtual bool TestCondition(FStateTreeExecutionContext& Context) const override;
 	virtual bool Link(FStateTreeLinker& Linker) override;
 	TStateTreeExternalDataHandle<FTransformFragment> EntityTransformHandle;
-	TStateTreeExternalDataHandle<FLocationDataFragment> LocationDataFragmentHandle;
+	TStateTreeExternalDataHandle<FLocationTargetFragment> LocationTargetFragmentHandle;
 	TStateTreeExternalDataHandle<FAnimationFragment> AnimationFragmentHandle;
 };
 
@@ -466,7 +501,7 @@ struct FWalkToEntityLocation : public FMassStateTreeTaskBase
 	TStateTreeExternalDataHandle<FAttackFragment> AttackFragmentHandle;
 	TStateTreeExternalDataHandle<FAnimationFragment> AnimationFragmentHandle;
 	TStateTreeExternalDataHandle<FNearEnemiesFragment> NearEnemiesFragHandle;
-	TStateTreeExternalDataHandle<FLocationDataFragment> LocationDataFragHandle;
+	TStateTreeExternalDataHandle<FLocationTargetFragment> LocationTargetFragHandle;
 	TStateTreeExternalDataHandle<USmbSubsystem> SmbSubsystemHandle;
 	TStateTreeExternalDataHandle<UMassSignalSubsystem> MassSignalSubsystemHandle;
 };
@@ -554,7 +589,7 @@ struct FAttackWithSkill : public FMassStateTreeTaskBase
 	TStateTreeExternalDataHandle<FAnimationFragment> AnimationFragmentHandle;
 	TStateTreeExternalDataHandle<FMassRepresentationFragment> MassRepFragmentHandle;
 	TStateTreeExternalDataHandle<FTeamFragment> TeamFragmentHandle;
-	TStateTreeExternalDataHandle<FLocationDataFragment> LocationDataHandle;
+	TStateTreeExternalDataHandle<FLocationTargetFragment> LocationTargetHandle;
 	
 	TStateTreeExternalDataHandle<FNearEnemiesFragment> NearEnemiesFragHandle;
 
@@ -704,6 +739,7 @@ struct FNewWalkTarget : public FMassStateTreeTaskBase
 	
 	//TStateTreeExternalDataHandle<UMassSignalSubsystem> MassSignalSubsystemHandle;
 	TStateTreeExternalDataHandle<FLocationDataFragment> LocationDataFragHandle;
+	TStateTreeExternalDataHandle<FLocationTargetFragment> LocationTargetFragHandle;
 	TStateTreeExternalDataHandle<FTransformFragment> TransformFragmentHandle;
 	TStateTreeExternalDataHandle<USmbSubsystem> SmbSubsystemHandle;
 };
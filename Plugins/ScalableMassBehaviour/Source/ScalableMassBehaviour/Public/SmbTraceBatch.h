@@ -0,0 +1,55 @@
+﻿// Copyright © 2025 Land Chaunax, All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+#include "MassEntityHandle.h"
+#include "Engine/EngineTypes.h"
+#include "Tasks/Task.h"
+
+/* One downward ground check of an entity and, once traced, what it hit */
+struct FSmbGroundTrace
+{
+	FMassEntityHandle Owner;
+	FVector Start = FVector::ZeroVector;
+	FVector End = FVector::ZeroVector;
+
+	/* Filled when traced */
+	FVector ImpactPoint = FVector::ZeroVector;
+	bool bHit = false;
+};
+
+/*
+ * Line traces of one processing pass, owned by USmbSubsystem. Chunks queue their traces from any thread, Launch traces the whole
+ * batch on worker threads and a later pass picks the results up with Complete once they are done, nobody waits for them.
+ * The pending, in flight and result buffers are swapped around instead of reallocated.
+ */
+class SCALABLEMASSBEHAVIOUR_API FSmbTraceBatch
+{
+public:
+	/* Thread safe, parallel chunks hand over their traces together */
+	void Submit(TArray<FSmbGroundTrace>& Traces);
+
+	/* Game thread. Traces everything queued since the last launch against Channel, the previous batch has to be completed */
+	void Launch(UWorld& World, ECollisionChannel Channel);
+	/* Game thread. Makes a finished batch the results Find returns until the next call, false while the batch in flight is still tracing */
+	bool Complete();
+
+	/* Result of the trace the owner queued in the completed batch, nullptr if it didn't queue one */
+	const FSmbGroundTrace* Find(FMassEntityHandle Owner) const;
+
+	/* Waits for the batch in flight, the world has to outlive it */
+	void Reset();
+
+private:
+	TArray<FSmbGroundTrace> Pending;
+	FCriticalSection PendingLock;
+	TArray<FSmbGroundTrace> InFlight;
+	UE::Tasks::FTask InFlightTask;
+	/* Set from Launch to Complete, also for an empty batch so its (empty) results replace the old ones */
+	bool bInFlight = false;
+	TArray<FSmbGroundTrace> Results;
+	/* Result index by FMassEntityHandle::Index, only the entries of the current results are set */
+	TArray<int32> ResultOfEntity;
+};
@@ -32,6 +32,7 @@ class USmbAnimTrait : public UMassEntityTraitBase
 	
 public:
 	virtual void BuildTemplate(FMassEntityTemplateBuildContext& BuildContext, const UWorld& World) const override;
+	virtual void PostLoad() override;
 
 	UPROPERTY(EditAnywhere, Category = "Smb")
 	FVertexAnimations InVertexFrag;
@@ -39,6 +40,9 @@ public:
 protected:
 	UPROPERTY(EditAnywhere, Category = "Smb")
 	FAnimationFragment InAnimationFragment;
+
+	UPROPERTY(EditAnywhere, Category = "Smb")
+	FAnimationParams InAnimationParams;
 	
 };
 
@@ -73,7 +77,7 @@ protected:
 	FAttackFragment InAttackFragment;
 
 	UPROPERTY(EditAnywhere, Category = "Smb")
-	FNearEnemiesFragment InNearEnemiesFragment;
+	FNearEnemiesParams InNearEnemiesParams;
 };
 
 UCLASS()
@@ -89,13 +93,17 @@ public:
 
 protected:
 	UPROPERTY(EditAnywhere, Category = "Smb")
-	FLocationDataFragment InDataFragment;
+	FLocationDataParams InLocationParams;
 
 	UPROPERTY(EditAnywhere, Category = "Smb");
-	FCollisionDataFragment InCollisionFrag;
+	FCollisionParams InCollisionParams;
+
+	/* Neighbours tracked for collision, MaxEntitiesToCheck above this is ignored */
+	UPROPERTY(EditAnywhere, Category = "Smb")
+	ESmbCollisionCapacity CollisionCapacity = ESmbCollisionCapacity::Four;
 
 	UPROPERTY(EditAnywhere, Category = "Smb");
-	FHeightFragment InHeightFrag;
+	FHeightParams InHeightParams;
 };
 
 UCLASS()
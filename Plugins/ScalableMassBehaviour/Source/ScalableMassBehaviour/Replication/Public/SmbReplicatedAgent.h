@@ -55,11 +55,11 @@ public:
 
 protected:
 #if UE_REPLICATION_COMPILE_CLIENT_CODE
-	static void SetEntityData(FLocationDataFragment& LocationDataFragment, const FSmbReplicatedMoveTarget& ReplicatedMoveTarget);
+	static void SetEntityData(FLocationTargetFragment& LocationTargetFragment, const FSmbReplicatedMoveTarget& ReplicatedMoveTarget);
 #endif // UE_REPLICATION_COMPILE_CLIENT_CODE
 
 protected:
-	TArrayView<FLocationDataFragment> LocationDataList;
+	TArrayView<FLocationTargetFragment> LocationTargetList;
 
 	TClientBubbleHandlerBase<AgentArrayItem>& OwnerHandler;
 };
@@ -125,7 +125,7 @@ template<typename AgentArrayItem>
 void TSmbClientTargetPositionHandler<AgentArrayItem>::AddRequirementsForSpawnQuery(FMassEntityQuery& InQuery)
 {
 	//InQuery.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadWrite);
-	InQuery.AddRequirement<FLocationDataFragment>(EMassFragmentAccess::ReadWrite);
+	InQuery.AddRequirement<FLocationTargetFragment>(EMassFragmentAccess::ReadWrite);
 }
 #endif // UE_REPLICATION_COMPILE_CLIENT_CODE
 
@@ -133,7 +133,7 @@ void TSmbClientTargetPositionHandler<AgentArrayItem>::AddRequirementsForSpawnQue
 template<typename AgentArrayItem>
 void TSmbClientTargetPositionHandler<AgentArrayItem>::CacheFragmentViewsForSpawnQuery(FMassExecutionContext& InExecContext)
 {
-	LocationDataList = InExecContext.GetMutableFragmentView<FLocationDataFragment>();
+	LocationTargetList = InExecContext.GetMutableFragmentView<FLocationTargetFragment>();
 }
 #endif // UE_REPLICATION_COMPILE_CLIENT_CODE
 
@@ -141,7 +141,7 @@ void TSmbClientTargetPositionHandler<AgentArrayItem>::CacheFragmentViewsForSpawn
 template<typename AgentArrayItem>
 void TSmbClientTargetPositionHandler<AgentArrayItem>::ClearFragmentViewsForSpawnQuery()
 {
-	LocationDataList = TArrayView<FLocationDataFragment>();
+	LocationTargetList = TArrayView<FLocationTargetFragment>();
 }
 #endif // UE_REPLICATION_COMPILE_CLIENT_CODE
 
@@ -149,9 +149,9 @@ void TSmbClientTargetPositionHandler<AgentArrayItem>::ClearFragmentViewsForSpawn
 template<typename AgentArrayItem>
 void TSmbClientTargetPositionHandler<AgentArrayItem>::SetSpawnedEntityData(const int32 EntityIdx, const FSmbReplicatedMoveTarget& ReplicatedMoveTarget) const
 {
-	FLocationDataFragment& LocationDataFrag = LocationDataList[EntityIdx];
+	FLocationTargetFragment& LocationTargetFrag = LocationTargetList[EntityIdx];
 
-	SetEntityData(LocationDataFrag, ReplicatedMoveTarget);
+	SetEntityData(LocationTargetFrag, ReplicatedMoveTarget);
 }
 #endif // UE_REPLICATION_COMPILE_CLIENT_CODE
 
@@ -161,19 +161,19 @@ void TSmbClientTargetPositionHandler<AgentArrayItem>::SetSpawnedEntityData(const
 template<typename AgentArrayItem>
 void TSmbClientTargetPositionHandler<AgentArrayItem>::SetModifiedEntityData(const FMassEntityView& EntityView, const FSmbReplicatedMoveTarget& ReplicatedMoveTarget)
 {
-	FLocationDataFragment& LocationDataFrag = EntityView.GetFragmentData<FLocationDataFragment>();
+	FLocationTargetFragment& LocationTargetFrag = EntityView.GetFragmentData<FLocationTargetFragment>();
 
-	SetEntityData(LocationDataFrag, ReplicatedMoveTarget);
+	SetEntityData(LocationTargetFrag, ReplicatedMoveTarget);
 }
 #endif // UE_REPLICATION_COMPILE_CLIENT_CODE
 
 #if UE_REPLICATION_COMPILE_CLIENT_CODE
 template<typename AgentArrayItem>
-void TSmbClientTargetPositionHandler<AgentArrayItem>::SetEntityData(FLocationDataFragment& LocationDataFragment, const FSmbReplicatedMoveTarget& ReplicatedMoveTarget)
+void TSmbClientTargetPositionHandler<AgentArrayItem>::SetEntityData(FLocationTargetFragment& LocationTargetFragment, const FSmbReplicatedMoveTarget& ReplicatedMoveTarget)
 {
-	LocationDataFragment.bNewLocation = true;
+	LocationTargetFragment.bNewLocation = true;
 	//UE_LOG(LogTemp, Display, TEXT("New Target Location X: %f Y: %f"),ReplicatedMoveTarget.TargetLocation.X,ReplicatedMoveTarget.TargetLocation.Y);
-	LocationDataFragment.NextLocation = ReplicatedMoveTarget.TargetLocation;
+	LocationTargetFragment.NextLocation = ReplicatedMoveTarget.TargetLocation;
 }
 #endif // UE_REPLICATION_COMPILE_CLIENT_CODE
 
@@ -184,15 +184,15 @@ class FSmbReplicationProcessorWalkTargetHandlerBase
 public:
 	static SCALABLEMASSBEHAVIOUR_API void AddRequirements(FMassEntityQuery& InQuery)
 	{
-		InQuery.AddRequirement<FLocationDataFragment>(EMassFragmentAccess::ReadWrite);
+		InQuery.AddRequirement<FLocationTargetFragment>(EMassFragmentAccess::ReadWrite);
 	};
 	SCALABLEMASSBEHAVIOUR_API void CacheFragmentViews(FMassExecutionContext& ExecContext)
 	{
-		LocationDataList = ExecContext.GetMutableFragmentView<FLocationDataFragment>();
+		LocationTargetList = ExecContext.GetMutableFragmentView<FLocationTargetFragment>();
 	};
 
 protected:
-	TArrayView<FLocationDataFragment> LocationDataList;
+	TArrayView<FLocationTargetFragment> LocationTargetList;
 };
 
 class FSmbReplicationProcessorWalkTargetHandler : public FSmbReplicationProcessorWalkTargetHandlerBase
@@ -200,8 +200,8 @@ class FSmbReplicationProcessorWalkTargetHandler : public FSmbReplicationProcesso
 public:
 	SCALABLEMASSBEHAVIOUR_API void AddEntity(const int32 EntityIdx, FSmbReplicatedMoveTarget& InOutReplicatedPathData) const
 	{
-		const FLocationDataFragment& LocationDataFragment = LocationDataList[EntityIdx];
-		InOutReplicatedPathData.TargetLocation = LocationDataFragment.NextLocation;
+		const FLocationTargetFragment& LocationTargetFragment = LocationTargetList[EntityIdx];
+		InOutReplicatedPathData.TargetLocation = LocationTargetFragment.NextLocation;
 	};
 
 	template<typename AgentArrayItem>
@@ -211,11 +211,11 @@ public:
 template<typename AgentArrayItem>
 void FSmbReplicationProcessorWalkTargetHandler::ModifyEntity(const FMassReplicatedAgentHandle Handle, const int32 EntityIdx, TSmbClientTargetPositionHandler<AgentArrayItem>& BubblePathHandler)
 {
-	const FLocationDataFragment& LocationDataFragment = LocationDataList[EntityIdx];
+	const FLocationTargetFragment& LocationTargetFragment = LocationTargetList[EntityIdx];
 
-	//UE_LOG(LogTemp, Display, TEXT("Bubble view location (server) X: %f Y:  %f"),LocationDataFragment.WalkToLocation.X,LocationDataFragment.WalkToLocation.Y);
+	//UE_LOG(LogTemp, Display, TEXT("Bubble view location (server) X: %f Y:  %f"),LocationTargetFragment.WalkToLocation.X,LocationTargetFragment.WalkToLocation.Y);
 
-	BubblePathHandler.SetBubbleMoveTargetFromLocation(Handle, LocationDataFragment.WalkToLocation);
+	BubblePathHandler.SetBubbleMoveTargetFromLocation(Handle, LocationTargetFragment.WalkToLocation);
 }
 
 